@@ -7,10 +7,16 @@
 #include <mutex>
 #include <assert.h>
 #include <memory>
+#include <atomic>
+#include <cstddef>
+#include <stdlib.h>
 
 namespace co
 {
 
+// 按Group分组的kv存储, 每个实例都拥有全部已注册的key
+// 小而且可以平凡析构的key存放在实例内部的内联区, 构造实例时直接构造;
+// 其他key首次get时才分配存储并构造, 不使用这些功能的实例不付出任何开销.
 template <typename Group>
 class Anys
 {
@@ -18,6 +24,13 @@ public:
     typedef void (*Constructor)(void*);
     typedef void (*Destructor)(void*);
 
+    // 内联区大小和对齐
+    static const std::size_t s_inlineSize = 24;
+    static const std::size_t s_inlineAlign = alignof(void*);
+
+    // 延迟构造的key数量上限
+    static const std::size_t s_maxLazyKeys = 64;
+
     template <typename T>
     struct DefaultConstructorDestructor
     {
@@ -34,37 +47,30 @@ public:
     template <typename T>
     static std::size_t Register()
     {
-        return Register<T>(&DefaultConstructorDestructor<T>::Constructor, &DefaultConstructorDestructor<T>::Destructor);
+        return Register<T>(&DefaultConstructorDestructor<T>::Constructor, &DefaultConstructorDestructor<T>::Destructor,
+                std::is_trivially_destructible<T>::value);
     }
 
     template <typename T>
     static std::size_t Register(Constructor constructor, Destructor destructor)
     {
-        std::unique_lock<std::mutex> lock(GetMutex());
-        std::unique_lock<LFLock> inited(GetInitGuard(), std::defer_lock);
-        if (!inited.try_lock())
-            throw std::logic_error("Anys::Register mustbe at front of new first instance.");
-
-        KeyInfo info;
-        info.align = std::alignment_of<T>::value;
-        info.size = sizeof(T);
-        info.offset = StorageLen();
-        info.constructor = constructor;
-        info.destructor = destructor;
-        GetKeys().push_back(info);
-        StorageLen() += info.align + info.size - 1;
-        Size()++;
-        return GetKeys().size() - 1;
+        return Register<T>(constructor, destructor, false);
     }
 
     template <typename T>
     ALWAYS_INLINE T& get(std::size_t index)
     {
-        if (index >= *(std::size_t*)hold_)
+        if (index >= Size())
             throw std::logic_error("Anys::get overflow");
 
-        char *p = storage_ + offsets_[index];
-        return *reinterpret_cast<T*>(p);
+        KeyInfo const& info = GetKeys()[index];
+        if (info.inlined)
+            return *reinterpret_cast<T*>(reinterpret_cast<char*>(&inline_) + info.offset);
+
+        if (LIKELY(constructed_.load(std::memory_order_acquire) & (uint64_t(1) << info.slot)))
+            return *reinterpret_cast<T*>(storage_ + info.offset);
+
+        return *reinterpret_cast<T*>(Construct(info));
     }
 
 private:
@@ -73,9 +79,54 @@ private:
         int align;
         int size;
         std::size_t offset;
+        bool inlined;
+        std::size_t slot;   // 延迟构造的key在constructed_中的位
         Constructor constructor;
         Destructor destructor;
     };
+
+    template <typename T>
+    static std::size_t Register(Constructor constructor, Destructor destructor, bool canInline)
+    {
+        std::unique_lock<std::mutex> lock(GetMutex());
+        std::unique_lock<LFLock> inited(GetInitGuard(), std::defer_lock);
+        if (!inited.try_lock())
+            throw std::logic_error("Anys::Register mustbe at front of new first instance.");
+
+        if (std::alignment_of<T>::value > std::alignment_of<std::max_align_t>::value)
+            throw std::logic_error("Anys::Register over-aligned type");
+
+        KeyInfo info;
+        info.align = std::alignment_of<T>::value;
+        info.size = sizeof(T);
+        info.constructor = constructor;
+        info.destructor = destructor;
+
+        std::size_t inlineOffset = AlignUp(InlineLen(), info.align);
+        info.inlined = canInline && (std::size_t)info.align <= s_inlineAlign
+            && inlineOffset + info.size <= s_inlineSize;
+        if (info.inlined) {
+            info.offset = inlineOffset;
+            info.slot = 0;
+            InlineLen() = inlineOffset + info.size;
+        } else {
+            if (LazyCount() >= s_maxLazyKeys)
+                throw std::logic_error("Anys::Register too many keys");
+
+            info.offset = AlignUp(StorageLen(), info.align);
+            info.slot = LazyCount()++;
+            StorageLen() = info.offset + info.size;
+        }
+
+        GetKeys().push_back(info);
+        Size()++;
+        return GetKeys().size() - 1;
+    }
+
+    inline static std::size_t AlignUp(std::size_t n, std::size_t align)
+    {
+        return (n + align - 1) / align * align;
+    }
     inline static std::vector<KeyInfo> & GetKeys()
     {
         static std::vector<Anys::KeyInfo> obj;
@@ -91,6 +142,16 @@ private:
         static std::size_t obj = 0;
         return obj;
     }
+    inline static std::size_t & InlineLen()
+    {
+        static std::size_t obj = 0;
+        return obj;
+    }
+    inline static std::size_t & LazyCount()
+    {
+        static std::size_t obj = 0;
+        return obj;
+    }
     inline static std::size_t & Size()
     {
         static std::size_t obj = 0;
@@ -102,43 +163,42 @@ private:
         return obj;
     }
 
+    // 首次访问延迟构造的key, 可能被多个线程同时调用
+    void* Construct(KeyInfo const& info)
+    {
+        std::unique_lock<LFLock> lock(lock_);
+        if (!storage_)
+            storage_ = (char*)malloc(StorageLen());
+
+        void* p = storage_ + info.offset;
+        uint64_t bit = uint64_t(1) << info.slot;
+        if (!(constructed_.load(std::memory_order_relaxed) & bit)) {
+            if (info.constructor)
+                info.constructor(p);
+            constructed_.fetch_or(bit, std::memory_order_release);
+        }
+        return p;
+    }
+
 private:
-    // TODO: 优化:紧凑内存布局, 提高利用率
-    char* hold_;
-    std::size_t* offsets_;
+    typename std::aligned_storage<s_inlineSize, s_inlineAlign>::type inline_;
     char* storage_;
+    std::atomic<uint64_t> constructed_;
+    LFLock lock_;
 
 public:
     Anys()
-        : hold_(nullptr), offsets_(nullptr), storage_(nullptr)
+        : storage_(nullptr), constructed_{0}
     {
         GetInitGuard().try_lock();
-        if (!Size()) return ;
-        hold_ = (char*)malloc(sizeof(std::size_t) * (Size() + 1) + StorageLen());
-        storage_ = hold_ + sizeof(std::size_t) * (Size() + 1);
-        *(std::size_t*)hold_ = Size();
-        offsets_ = (std::size_t*)(hold_ + sizeof(std::size_t));
-        for (std::size_t i = 0; i < Size(); i++) {
-            auto const& keyInfo = GetKeys()[i];
-            std::size_t offset = keyInfo.offset;
-            std::size_t space = keyInfo.align + keyInfo.size - 1;
-            char *base = storage_ + offset;
-            void *ptr = base;
-            if (!align(keyInfo.align, keyInfo.size, ptr, space))
-                throw std::logic_error("Anys::get call std::align error");
-            offset += (char*)ptr - base;
-            offsets_[i] = offset;
-        }
         Init();
     }
 
     ~Anys()
     {
         Deinit();
-        if (hold_) {
-            free(hold_);
-            hold_ = nullptr;
-            offsets_ = nullptr;
+        if (storage_) {
+            free(storage_);
             storage_ = nullptr;
         }
     }
@@ -149,46 +209,32 @@ public:
         Init();
     }
 
+    // 只构造内联区的key, 其他key在首次get时构造
     void Init()
     {
-        if (!Size()) return ;
         for (std::size_t i = 0; i < Size(); i++)
         {
             auto const& keyInfo = GetKeys()[i];
-            if (!keyInfo.constructor)
+            if (!keyInfo.inlined || !keyInfo.constructor)
                 continue;
 
-            char *p = storage_ + offsets_[i];
-            keyInfo.constructor(p);
+            keyInfo.constructor(reinterpret_cast<char*>(&inline_) + keyInfo.offset);
         }
     }
 
     void Deinit()
     {
-        if (!Size()) return ;
+        uint64_t constructed = constructed_.exchange(0, std::memory_order_acquire);
         for (std::size_t i = 0; i < Size(); i++)
         {
             auto const& keyInfo = GetKeys()[i];
             if (!keyInfo.destructor)
                 continue;
 
-            char *p = storage_ + offsets_[i];
-            keyInfo.destructor(p);
-        }
-    }
-
-    // Copy from g++ std.
-    inline void* align(size_t __align, size_t __size, void*& __ptr, size_t& __space) noexcept
-    {
-        const auto __intptr = reinterpret_cast<uintptr_t>(__ptr);
-        const auto __aligned = (__intptr - 1u + __align) & -__align;
-        const auto __diff = __aligned - __intptr;
-        if ((__size + __diff) > __space)
-            return nullptr;
-        else
-        {
-            __space -= __diff;
-            return __ptr = reinterpret_cast<void*>(__aligned);
+            if (keyInfo.inlined)
+                keyInfo.destructor(reinterpret_cast<char*>(&inline_) + keyInfo.offset);
+            else if (constructed & (uint64_t(1) << keyInfo.slot))
+                keyInfo.destructor(storage_ + keyInfo.offset);
         }
     }
 };
@@ -24,47 +24,98 @@ public:
     static time_point now() noexcept {
         if (!self().fast_)
             return base_clock_t::now();
-        else {
-            auto &checkPoint = self().checkPoint_[self().switchIdx_];
-            uint64_t dtsc = rdtsc() - checkPoint.tsc_;
-            long dur = checkPoint.tp_.time_since_epoch().count() + dtsc / self().cycle_;
-            return time_point(duration(dur));
+
+        uint64_t tsc = rdtsc();
+
+        // 距离上次校准过久时, 由调用者顺便校准一次, 无需后台线程周期性唤醒.
+        // 先校准再用新的校准点计算, 不用旧的频率外推很长的时间.
+        // 长时间空闲后可能有多个线程同时发现需要校准, 没抢到校准锁的线程等校准完成后重新读取校准点,
+        // 不能用旧的校准点计算(那样得到的时间停留在旧校准点之后一个校准周期, 可能已经是很久以前).
+        for (;;) {
+            CheckPoint const& checkPoint = self().checkPoint_[self().switchIdx_];
+            if (LIKELY(tsc <= checkPoint.tsc_ + self().recalibrateCycles_))
+                return Extrapolate(checkPoint, tsc);
+
+            if (!Recalibrate())
+                std::this_thread::yield();
         }
     }
 
+    // 原始的tsc计数, 只用来计算时长(如协程占用的cpu时间), 只有一条rdtsc指令的开销
+    static uint64_t ticks() noexcept {
+        return rdtsc();
+    }
+
+    // tsc计数的差值换算成纳秒, 校准完成前按1:1换算
+    static uint64_t ticks_to_ns(uint64_t ticks) noexcept {
+        return (uint64_t)(ticks / self().cycle_);
+    }
+
+    // 初始校准: 取两个相隔20ms的校准点算出tsc频率, 之后不再周期性唤醒.
     static void ThreadRun() {
         std::unique_lock<LFLock> lock(self().threadInit_, std::defer_lock);
         if (!lock.try_lock()) return;
 
-        for (;;std::this_thread::sleep_for(std::chrono::milliseconds(20))) {
-            auto &checkPoint = self().checkPoint_[!self().switchIdx_];
-            checkPoint.tp_ = base_clock_t::now();
-            checkPoint.tsc_ = rdtsc();
-
-            auto &lastCheckPoint = self().checkPoint_[self().switchIdx_];
-            if (lastCheckPoint.tsc_ != 0) {
-                duration dur = checkPoint.tp_ - lastCheckPoint.tp_;
-                uint64_t dtsc = checkPoint.tsc_ - lastCheckPoint.tsc_;
-                float cycle = (float)dtsc / (std::max<long>)(dur.count(), 1);
-                if (cycle < std::numeric_limits<float>::min())
-                    cycle = std::numeric_limits<float>::min();
-                self().cycle_ = cycle;
-                self().fast_ = true;
+        Recalibrate();
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        Recalibrate();
+    }
+
+private:
+    struct CheckPoint {
+        time_point tp_;
+        uint64_t tsc_ = 0;
+    };
+
+    // 从校准点外推tsc对应的时间.
+    // now()只在一个校准周期之内外推; 校准时用来保证新校准点不倒退, 跨度同样限制在一个校准周期,
+    // 长时间空闲后不用旧频率外推出偏差很大的时间.
+    static time_point Extrapolate(CheckPoint const& checkPoint, uint64_t tsc) {
+        uint64_t dtsc = tsc > checkPoint.tsc_ ? tsc - checkPoint.tsc_ : 0;
+        if (dtsc > self().recalibrateCycles_)
+            dtsc = self().recalibrateCycles_;
+        return checkPoint.tp_ + duration((rep)(dtsc / self().cycle_));
+    }
+
+    // 其他线程正在校准时返回false
+    static bool Recalibrate() {
+        std::unique_lock<LFLock> lock(self().calibrateLock_, std::defer_lock);
+        if (!lock.try_lock()) return false;
+
+        auto &checkPoint = self().checkPoint_[!self().switchIdx_];
+        checkPoint.tp_ = base_clock_t::now();
+        checkPoint.tsc_ = rdtsc();
+
+        auto &lastCheckPoint = self().checkPoint_[self().switchIdx_];
+        if (lastCheckPoint.tsc_ != 0) {
+            // 新的校准点不早于旧校准点外推出的时间, 保证已经返回过的时间不会倒退.
+            // 频率按调整后的时间计算, 外推偏快时下一个周期会自动放慢.
+            if (self().fast_) {
+                time_point last = Extrapolate(lastCheckPoint, checkPoint.tsc_);
+                if (checkPoint.tp_ < last)
+                    checkPoint.tp_ = last;
             }
-            
-            self().switchIdx_ = !self().switchIdx_;
+
+            duration dur = checkPoint.tp_ - lastCheckPoint.tp_;
+            uint64_t dtsc = checkPoint.tsc_ - lastCheckPoint.tsc_;
+            float cycle = (float)dtsc / (std::max<long>)(dur.count(), 1);
+            if (cycle < std::numeric_limits<float>::min())
+                cycle = std::numeric_limits<float>::min();
+            self().cycle_ = cycle;
+            self().recalibrateCycles_ = (uint64_t)(cycle * std::chrono::duration_cast<duration>(
+                        std::chrono::milliseconds(20)).count());
+            self().fast_ = true;
         }
+
+        self().switchIdx_ = !self().switchIdx_;
+        return true;
     }
 
-private:
     struct Data {
-        struct CheckPoint {
-            time_point tp_;
-            uint64_t tsc_ = 0;
-        };
-
         LFLock threadInit_;
+        LFLock calibrateLock_;
         bool fast_ = false;
+        uint64_t recalibrateCycles_ = (std::numeric_limits<uint64_t>::max)();
         double cycle_ = 1;
         CheckPoint checkPoint_[2];
         volatile int switchIdx_ = 0;
@@ -87,6 +138,14 @@ class FastSteadyClock
 {
 public:
 	static void ThreadRun() {}
+
+	static uint64_t ticks() noexcept {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(now().time_since_epoch()).count();
+	}
+
+	static uint64_t ticks_to_ns(uint64_t ticks) noexcept {
+		return ticks;
+	}
 };
 #endif
 
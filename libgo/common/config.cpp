@@ -26,6 +26,8 @@ static int staticInitialize()
     TaskRefInit(Affinity);
     TaskRefInit(Location);
     TaskRefInit(DebugInfo);
+    TaskRefInit(WakeMigrateTick);
+    TaskRefInit(RunnableTick);
 //    TaskRefInit(SuspendId);
 
     // cls
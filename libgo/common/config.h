@@ -124,6 +124,14 @@ enum class eCoExHandle : uint8_t
     on_listener,        // 使用listener处理, 如果没设置listener则立刻抛出
 };
 
+// 协程被唤醒时放到哪个P上执行
+enum class eWakePlacement : uint8_t
+{
+    original,   // 挂起前所在的P
+    waker,      // 原P繁忙或已挂起时, 放到唤醒方所在的P (唤醒方不是同一个调度器的P时同original)
+    idle,       // 原P繁忙或已挂起时, 放到负载最低的空闲P上; 没有空闲的P时同waker
+};
+
 typedef void*(*stack_malloc_fn_t)(size_t size);
 typedef void(*stack_free_fn_t)(void *ptr);
 
@@ -146,12 +154,17 @@ struct CoroutineOptions
     // stack_size建议设置不超过1MB
     // Linux系统下, 设置2MB的stack_size会导致提交内存的使用量比1MB的stack_size多10倍.
     uint32_t stack_size = 1 * 1024 * 1024; 
+
+    // 共享栈模式(co_shared_stack)下每个P的共享栈大小, 只会影响在此值设置之后新创建的P.
+    // 共享栈按需分配, 只有P上运行过共享栈协程时才会分配.
+    uint32_t shared_stack_size = 1 * 1024 * 1024;
     /************************************************************/
 
     // epoll每次触发的event数量(Windows下无效)
     uint32_t epoll_event_size = 10240;
 
     // 是否启用协程统计功能(会有一点性能损耗, 默认不开启)
+    // 开启后每个P记录调度计数和排队时长、时间片长度的直方图, 通过Scheduler::GetStats获取
     bool enable_coro_stat = false;
 
     // 单协程执行超时时长(单位：微秒) (超过时长会强制steal剩余任务, 派发到其他线程)
@@ -159,18 +172,90 @@ struct CoroutineOptions
 
     // 调度线程的触发频率(单位：微秒)
     uint32_t dispatcher_thread_cycle_us = 1000; 
+
+    // 因阻塞而扩展出来的多余调度线程(P), 空闲超过这个时长后退出(单位：微秒), 为0时不退出
+    uint32_t processer_idle_timeout_us = 10 * 1000 * 1000;
+
+    // 扩展调度线程的最小时间间隔(单位：微秒), 防止阻塞风暴时瞬间创建大量线程
+    uint32_t processer_spawn_interval_us = 10 * 1000;
+
+    // P空闲时先自旋等待的最长时长(单位：微秒), 前半段pause忙等, 后半段sched_yield, 之后才挂起线程.
+    // 为0时直接挂起. 对唤醒延迟敏感的场景可以设置为几十到几百微秒.
+    uint32_t processer_spin_us = 0;
+
+    // 根据实际观测到的空闲时长自动调整自旋时长:
+    // 新任务的平均到达间隔超过processer_spin_us时不再自旋, 否则只自旋平均间隔的2倍.
+    bool processer_spin_adaptive = true;
+
     //  负载均衡触发的比例,取值范围 0 - 1
     //  当某个执行器的协程数少于平均值的load_balance_rate就会触发负载均衡
     //  若执行的协程任务比较重时,此值建议设低一点,协程任务比较轻时,建议设高一点
     float load_balance_rate = 0.01; 
 
+    // 按协程占用的cpu时间做负载均衡: 每次切换用tsc统计协程和P的cpu时间,
+    // P的负载 = 待执行协程数 x 指数衰减的平均时间片长度, 而不仅仅是协程数.
+    // 少量重计算协程和大量轻IO协程混合时更均衡.
+    // 每次切换多一次读tsc(虚拟机中约20ns), 对切换频繁的轻量协程开销明显, 因此默认关闭.
+    // 关闭时按协程数均衡, 切换时不计时.
+    bool load_balance_by_cpu_time = false;
+
+    // 优先级老化阈值: 低优先级的runnable协程连续被高优先级协程插队这么多次后, 强制调度一次,
+    // 防止低优先级协程饿死. 为0时不做老化.
+    uint32_t priority_aging_quota = 64;
+
+    // runnext: 协程唤醒同一个P上的其他协程(channel、mutex等)时, 被唤醒的协程插队到下一个执行,
+    // 生产者/消费者交接的数据还在缓存中. 连续通过runnext调度这么多次后回到正常的队列顺序,
+    // 防止互相唤醒的一组协程饿死队列中的其他协程. 为0时关闭.
+    uint32_t runnext_quota = 16;
+
+    // 唤醒协程时的放置策略. 原P空闲并且醒着时总是放回原P(缓存还是热的);
+    // 绑定了P(affinity)的协程和共享栈协程总是放回原P.
+    eWakePlacement wake_placement = eWakePlacement::original;
+
+    // 协程因唤醒而迁移后, 这么长时间内不再因唤醒而迁移(单位：微秒),
+    // 防止流水线上的协程在几个P之间来回跳, 让它在新的P上重新积累缓存.
+    uint32_t wake_migrate_interval_us = 1000;
+
+    // CPU绑定(仅linux下有效, 为空时不绑定), 需在Start之前设置
+    // 第i个调度线程(P)绑定到processer_cpus[i % size]上, 负载均衡时优先在同一NUMA节点的P之间迁移协程
+    std::vector<int> processer_cpus;
+    // reactor线程可以运行的CPU集合, 需在第一次hook网络io之前设置
+    std::vector<int> reactor_cpus;
+    // 定时器线程(以及调度线程、时钟校准线程)可以运行的CPU集合
+    std::vector<int> timer_cpus;
+
     // 栈顶设置保护内存段的内存页数量(仅linux下有效)(默认为0, 即:不设置)
     // 在栈顶内存对齐后的前几页设置为protect属性.
     // 所以开启此选项时, stack_size不能少于protect_stack_page+1页
     int & protect_stack_page;
 
+    // 使用栈内存池分配协程栈(仅linux下有效, 需在创建第一个协程之前设置)
+    // 按栈大小一次预留大段虚拟内存, 每个栈预先放置保护页, 物理内存按需提交,
+    // 协程结束后栈的物理内存通过MADV_FREE归还, 地址和保护页留给后面的协程复用.
+    // 开启后protect_stack_page和stack_malloc_fn/stack_free_fn对协程栈不再生效.
+    // 注意: 每个保护页都会拆分出一个独立的内存映射, 海量协程时需要调大vm.max_map_count.
+    bool stack_arena = false;
+
+    // 栈内存池中每个栈的保护页数量, 为0时不设置保护页
+    uint32_t stack_arena_guard_pages = 1;
+
+    // 栈使用量采样(需开启stack_arena): 每N个协程栈采样一次实际使用的最大深度,
+    // 按创建协程的代码位置统计(StackArena::GetUsageStats), 为0时不采样
+    uint32_t stack_usage_sample = 0;
+
+    // Task对象从大页内存池(HugePageArena)中分配(仅linux下有效, 需在创建第一个协程之前设置)
+    // 协程栈也使用大页时设置: stack_malloc_fn = &HugePageArena::Malloc; stack_free_fn = &HugePageArena::Free;
+    // 大页中的栈整页提交物理内存, 每个栈的RSS就是栈大小, 而普通页只提交实际用到的几KB,
+    // 只适合较小的栈(如co_stack(16 * 1024)); 大于约1MB的栈(包括默认大小)仍然单独映射普通页.
+    bool task_hugepage_arena = false;
+
+    // 大页内存池优先使用显式大页(MAP_HUGETLB, 需要预留vm.nr_hugepages), 失败时退化为透明大页.
+    // 为false时使用透明大页(MADV_HUGEPAGE), 系统不支持时就是普通页.
+    bool hugepage_explicit = false;
+
     // 设置栈内存管理(malloc/free)
     // 使用fiber做协程底层时无效
+    // 使用HugePageArena时注意上面task_hugepage_arena说明的RSS代价
     stack_malloc_fn_t & stack_malloc_fn;
     stack_free_fn_t & stack_free_fn;
 
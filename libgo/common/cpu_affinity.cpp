@@ -0,0 +1,88 @@
+#include "cpu_affinity.h"
+#if defined(LIBGO_SYS_Linux)
+#include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#endif
+
+namespace co
+{
+
+#if defined(LIBGO_SYS_Linux)
+static bool BindPThreadToCpus(pthread_t thread, std::vector<int> const& cpus)
+{
+    if (cpus.empty()) return false;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        if (cpu >= 0 && cpu < CPU_SETSIZE)
+            CPU_SET(cpu, &set);
+    }
+
+    int res = pthread_setaffinity_np(thread, sizeof(set), &set);
+    DebugPrint(dbg_thread, "bind thread(%lu) to %d cpus. res = %d",
+            (unsigned long)thread, (int)cpus.size(), res);
+    return res == 0;
+}
+
+bool BindCurrentThreadToCpus(std::vector<int> const& cpus)
+{
+    return BindPThreadToCpus(pthread_self(), cpus);
+}
+
+bool BindThreadToCpus(std::thread & thread, std::vector<int> const& cpus)
+{
+    return BindPThreadToCpus(thread.native_handle(), cpus);
+}
+
+static std::vector<int> LoadCpuNumaNodes()
+{
+    // /sys/devices/system/cpu/cpuN/nodeX
+    std::vector<int> nodes;
+    for (int cpu = 0; ; ++cpu) {
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+        DIR* dir = opendir(path);
+        if (!dir) break;
+
+        int node = -1;
+        while (struct dirent* ent = readdir(dir)) {
+            if (strncmp(ent->d_name, "node", 4) == 0 && ent->d_name[4] >= '0' && ent->d_name[4] <= '9') {
+                node = atoi(ent->d_name + 4);
+                break;
+            }
+        }
+        closedir(dir);
+        nodes.push_back(node);
+    }
+    return nodes;
+}
+
+int GetNumaNodeOfCpu(int cpu)
+{
+    static std::vector<int> nodes = LoadCpuNumaNodes();
+    if (cpu < 0 || cpu >= (int)nodes.size()) return -1;
+    return nodes[cpu];
+}
+#else
+bool BindCurrentThreadToCpus(std::vector<int> const& cpus)
+{
+    return false;
+}
+
+bool BindThreadToCpus(std::thread & thread, std::vector<int> const& cpus)
+{
+    return false;
+}
+
+int GetNumaNodeOfCpu(int cpu)
+{
+    return -1;
+}
+#endif
+
+} // namespace co
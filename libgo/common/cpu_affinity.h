@@ -0,0 +1,18 @@
+#pragma once
+#include "config.h"
+#include <thread>
+
+namespace co
+{
+
+// CPU绑定与NUMA拓扑 (仅linux下有效, 其他平台下绑定总是失败, NUMA节点总是-1)
+
+// 把线程绑定到cpus中的CPU上(允许在这些CPU之间迁移), cpus为空时不做任何事
+// @returns: 是否绑定成功
+bool BindCurrentThreadToCpus(std::vector<int> const& cpus);
+bool BindThreadToCpus(std::thread & thread, std::vector<int> const& cpus);
+
+// CPU所在的NUMA节点, 未知时返回-1
+int GetNumaNodeOfCpu(int cpu);
+
+} // namespace co
@@ -0,0 +1,156 @@
+#include "hugepage_arena.h"
+#include <new>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#if defined(LIBGO_SYS_Linux)
+#include <sys/mman.h>
+#endif
+
+namespace co
+{
+
+static const uint32_t kChunkMagic = 0x48504152;
+
+std::atomic<uint64_t> HugePageArena::s_mapped_{0};
+std::atomic<uint64_t> HugePageArena::s_explicit_{0};
+
+uint64_t HugePageArena::MappedBytes()
+{
+    return s_mapped_;
+}
+
+uint64_t HugePageArena::ExplicitHugePageBytes()
+{
+    return s_explicit_;
+}
+
+#if defined(LIBGO_SYS_Linux)
+HugePageArena::Shard& HugePageArena::CurrentShard()
+{
+    static Shard shards[kShardCount];
+    static std::atomic<uint32_t> next{0};
+    static thread_local uint32_t idx = next++ % kShardCount;
+    return shards[idx];
+}
+
+char* HugePageArena::MapChunk(std::size_t bytes, bool huge)
+{
+    if (huge && CoroutineOptions::getInstance().hugepage_explicit) {
+        // 显式大页: 需要系统预留(vm.nr_hugepages), 映射地址天然按2MB对齐
+        void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            s_mapped_ += bytes;
+            s_explicit_ += bytes;
+            return (char*)p;
+        }
+
+        DebugPrint(dbg_task, "hugepage arena MAP_HUGETLB failed, fallback to THP. error=%s",
+                strerror(errno));
+    }
+
+    // 透明大页: 多映射2MB用于对齐, 再把首尾多余的部分还回去
+    std::size_t total = bytes + kChunkSize;
+    char* raw = (char*)mmap(nullptr, total, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == (char*)MAP_FAILED)
+        return nullptr;
+
+    char* aligned = (char*)(((std::size_t)raw + kChunkSize - 1) & ~(kChunkSize - 1));
+    if (aligned > raw)
+        munmap(raw, aligned - raw);
+    if (raw + total > aligned + bytes)
+        munmap(aligned + bytes, raw + total - (aligned + bytes));
+
+    // 不支持透明大页时madvise失败, 仍然可以当作普通内存使用
+#if defined(MADV_HUGEPAGE)
+    if (huge)
+        madvise(aligned, bytes, MADV_HUGEPAGE);
+#endif
+    s_mapped_ += bytes;
+    return aligned;
+}
+
+void* HugePageArena::Malloc(std::size_t size)
+{
+    size = (size + 63) & ~(std::size_t)63;
+
+    if (size > kMaxBlockSize) {
+        // 一个块中放不下两个的大块内存单独映射, 使用普通页按需提交物理内存.
+        // 否则1MB的栈会独占一个2MB的大页, 浪费一半的地址空间, 触碰后整页提交物理内存.
+        static const std::size_t pageSize = sysconf(_SC_PAGESIZE);
+        std::size_t bytes = (size + kHeaderSize + pageSize - 1) & ~(pageSize - 1);
+        char* base = MapChunk(bytes, false);
+        if (!base)
+            return nullptr;
+
+        ChunkHeader* header = (ChunkHeader*)base;
+        header->magic_ = kChunkMagic;
+        header->blockSize_ = 0;
+        header->owner_ = nullptr;
+        header->mapSize_ = bytes;
+        return base + kHeaderSize;
+    }
+
+    Shard & shard = CurrentShard();
+    std::unique_lock<std::mutex> lock(shard.mtx_);
+    Shard::SizeClass & sc = shard.classes_[size];
+    if (!sc.free_.empty()) {
+        void* p = sc.free_.back();
+        sc.free_.pop_back();
+        return p;
+    }
+
+    if ((std::size_t)(sc.end_ - sc.cursor_) < size) {
+        char* base = MapChunk(kChunkSize, true);
+        if (!base)
+            return nullptr;
+
+        ChunkHeader* header = (ChunkHeader*)base;
+        header->magic_ = kChunkMagic;
+        header->blockSize_ = (uint32_t)size;
+        header->owner_ = &shard;
+        header->mapSize_ = kChunkSize;
+        sc.cursor_ = base + kHeaderSize;
+        sc.end_ = base + kChunkSize;
+    }
+
+    void* p = sc.cursor_;
+    sc.cursor_ += size;
+    return p;
+}
+
+void HugePageArena::Free(void* ptr)
+{
+    if (!ptr) return ;
+
+    ChunkHeader* header = (ChunkHeader*)((std::size_t)ptr & ~(kChunkSize - 1));
+    assert(header->magic_ == kChunkMagic);
+
+    if (!header->blockSize_) {
+        s_mapped_ -= header->mapSize_;
+        munmap(header, header->mapSize_);
+        return ;
+    }
+
+    // 还给分配它的分片
+    Shard & shard = *header->owner_;
+    std::unique_lock<std::mutex> lock(shard.mtx_);
+    shard.classes_[header->blockSize_].free_.push_back(ptr);
+}
+#else //defined(LIBGO_SYS_Linux)
+void* HugePageArena::Malloc(std::size_t size)
+{
+    return ::malloc(size);
+}
+
+void HugePageArena::Free(void* ptr)
+{
+    ::free(ptr);
+}
+#endif //defined(LIBGO_SYS_Linux)
+
+} // namespace co
@@ -0,0 +1,73 @@
+#pragma once
+#include "config.h"
+#include <mutex>
+#include <map>
+#include <vector>
+#include <atomic>
+
+namespace co
+{
+
+// 大页内存池(仅linux下有效, 其他平台直接使用malloc/free)
+// 从2MB对齐的大页中切分固定大小的内存块, 减少海量协程切换时的TLB miss.
+// 每个线程(即每个P)优先使用自己的分片, 同一个P上创建的协程栈和Task对象集中在少数几个大页中.
+// 可以作为协程栈的分配函数:
+//      co_opt.stack_malloc_fn = &co::HugePageArena::Malloc;
+//      co_opt.stack_free_fn = &co::HugePageArena::Free;
+// Task对象使用大页内存池见CoroutineOptions::task_hugepage_arena.
+//
+// 注意: 大页整页提交物理内存, 栈不再按需提交, 适合较小的协程栈;
+//       大于kMaxBlockSize(约1MB)的内存块单独映射普通页, 不使用大页, 默认大小(1MB)的栈也是如此;
+//       栈保护页(protect_stack_page)会拆散大页, 使用大页时建议关闭.
+class HugePageArena
+{
+public:
+    static const std::size_t kChunkSize = 2 * 1024 * 1024;
+
+    static void* Malloc(std::size_t size);
+
+    static void Free(void* ptr);
+
+    // 已经映射的内存总量, 以及其中由显式大页(MAP_HUGETLB)提供的部分
+    static uint64_t MappedBytes();
+    static uint64_t ExplicitHugePageBytes();
+
+private:
+    struct Shard
+    {
+        struct SizeClass
+        {
+            std::vector<void*> free_;
+            char* cursor_ = nullptr;
+            char* end_ = nullptr;
+        };
+
+        std::mutex mtx_;
+        std::map<std::size_t, SizeClass> classes_;
+    };
+
+    // 每个2MB块的头部, 释放时通过地址对齐找到
+    struct ChunkHeader
+    {
+        uint32_t magic_;
+        uint32_t blockSize_;    // 0表示单独映射的大块内存
+        Shard* owner_;
+        std::size_t mapSize_;
+    };
+
+    static const std::size_t kHeaderSize = 64;
+    static const std::size_t kShardCount = 64;
+
+    // 从大页中切分的最大内存块, 保证一个块中至少能放下两个
+    static const std::size_t kMaxBlockSize = ((kChunkSize - kHeaderSize) / 2) & ~(std::size_t)63;
+
+    static Shard& CurrentShard();
+
+    // @huge: 是否使用大页. 映射地址按kChunkSize对齐, 以便释放时找到块头
+    static char* MapChunk(std::size_t bytes, bool huge);
+
+    static std::atomic<uint64_t> s_mapped_;
+    static std::atomic<uint64_t> s_explicit_;
+};
+
+} // namespace co
@@ -0,0 +1,90 @@
+#pragma once
+#include "config.h"
+#include <atomic>
+#if defined(LIBGO_SYS_Linux)
+# include <unistd.h>
+# include <sys/syscall.h>
+# include <linux/futex.h>
+#else
+# include <mutex>
+# include <condition_variable>
+#endif
+
+namespace co
+{
+
+// 线程挂起/唤醒原语 (单消费者, 多生产者)
+// 状态字: empty -> parked (Park) / empty|parked -> notified (Unpark)
+// Unpark只有在对方确实挂起时才会进入内核, 线程醒着时只是一次原子交换.
+// linux下基于futex, 其他平台基于mutex + condition_variable.
+class Parker
+{
+public:
+    enum { empty = 0, notified = 1, parked = -1 };
+
+    // 挂起当前线程, 直到被Unpark. 之前已有的Unpark会让Park立即返回.
+    void Park()
+    {
+        // notified -> empty 或 empty -> parked
+        if (state_.fetch_sub(1, std::memory_order_acquire) == notified)
+            return ;
+
+        for (;;) {
+            Wait();
+            int expected = notified;
+            if (state_.compare_exchange_strong(expected, empty, std::memory_order_acquire))
+                return ;
+        }
+    }
+
+    // 唤醒线程, 如果对方没有挂起, 则下一次Park立即返回
+    void Unpark()
+    {
+        if (state_.exchange(notified, std::memory_order_release) == parked)
+            Wake();
+    }
+
+    ALWAYS_INLINE bool IsParked() const { return state_.load(std::memory_order_relaxed) == parked; }
+
+    ALWAYS_INLINE bool IsNotified() const { return state_.load(std::memory_order_relaxed) == notified; }
+
+    // 消费掉未处理的唤醒
+    ALWAYS_INLINE void Reset()
+    {
+        int expected = notified;
+        state_.compare_exchange_strong(expected, empty, std::memory_order_acquire);
+    }
+
+private:
+#if defined(LIBGO_SYS_Linux)
+    void Wait()
+    {
+        ::syscall(SYS_futex, &state_, FUTEX_WAIT_PRIVATE, (int)parked, nullptr, nullptr, 0);
+    }
+
+    void Wake()
+    {
+        ::syscall(SYS_futex, &state_, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+    }
+#else
+    void Wait()
+    {
+        std::unique_lock<std::mutex> lock(mtx_);
+        while (state_.load(std::memory_order_acquire) == parked)
+            cv_.wait(lock);
+    }
+
+    void Wake()
+    {
+        std::unique_lock<std::mutex> lock(mtx_);
+        cv_.notify_one();
+    }
+
+    std::mutex mtx_;
+    std::condition_variable cv_;
+#endif
+
+    std::atomic<int> state_{empty};
+};
+
+} // namespace co
@@ -0,0 +1,163 @@
+#pragma once
+#include "config.h"
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <utility>
+#include <type_traits>
+
+namespace co
+{
+
+// 只能移动的void()可调用对象, 类似std::function<void()>
+// 不大于InlineSize的可调用对象直接存放在对象内部, 不分配堆内存;
+// 支持unique_ptr等只能移动的捕获.
+// 和std::function一样, 调用空对象时抛出std::bad_function_call; 由空的std::function或空函数指针构造时得到空对象.
+template <std::size_t InlineSize>
+class SmallFunction
+{
+    typedef typename std::aligned_storage<InlineSize, alignof(std::max_align_t)>::type Storage;
+
+    struct Ops
+    {
+        void (*call)(void* p);
+        void (*move)(void* dst, void* src);     // 移动到dst并析构src
+        void (*destroy)(void* p);
+    };
+
+    template <typename F>
+    struct InlineOps
+    {
+        static void call(void* p) { (*static_cast<F*>(p))(); }
+        static void move(void* dst, void* src) {
+            new (dst) F(std::move(*static_cast<F*>(src)));
+            static_cast<F*>(src)->~F();
+        }
+        static void destroy(void* p) { static_cast<F*>(p)->~F(); }
+        static Ops const* ops() {
+            static const Ops obj = { &call, &move, &destroy };
+            return &obj;
+        }
+    };
+
+    template <typename F>
+    struct HeapOps
+    {
+        static F*& ptr(void* p) { return *static_cast<F**>(p); }
+        static void call(void* p) { (*ptr(p))(); }
+        static void move(void* dst, void* src) { *static_cast<F**>(dst) = ptr(src); }
+        static void destroy(void* p) { delete ptr(p); }
+        static Ops const* ops() {
+            static const Ops obj = { &call, &move, &destroy };
+            return &obj;
+        }
+    };
+
+    template <typename F>
+    struct IsInline
+        : std::integral_constant<bool, sizeof(F) <= InlineSize
+            && alignof(Storage) % alignof(F) == 0
+            && std::is_nothrow_move_constructible<F>::value>
+    {};
+
+    template <typename F>
+    static bool IsEmpty(F const&) { return false; }
+
+    template <typename Signature>
+    static bool IsEmpty(std::function<Signature> const& f) { return !f; }
+
+    template <typename R, typename... Args>
+    static bool IsEmpty(R (*f)(Args...)) { return !f; }
+
+public:
+    static const std::size_t inline_size = InlineSize;
+
+    SmallFunction() noexcept {}
+
+    SmallFunction(std::nullptr_t) noexcept {}
+
+    template <typename Function, typename F = typename std::decay<Function>::type,
+             typename = typename std::enable_if<!std::is_same<F, SmallFunction>::value>::type>
+    SmallFunction(Function && f)
+    {
+        if (IsEmpty(f))
+            return ;
+        init<F>(std::forward<Function>(f), IsInline<F>());
+    }
+
+    SmallFunction(SmallFunction && other) noexcept
+    {
+        if (other.ops_) {
+            other.ops_->move(&storage_, &other.storage_);
+            ops_ = other.ops_;
+            other.ops_ = nullptr;
+        }
+    }
+
+    SmallFunction& operator=(SmallFunction && other) noexcept
+    {
+        if (this != &other) {
+            reset();
+            if (other.ops_) {
+                other.ops_->move(&storage_, &other.storage_);
+                ops_ = other.ops_;
+                other.ops_ = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    SmallFunction(SmallFunction const&) = delete;
+    SmallFunction& operator=(SmallFunction const&) = delete;
+
+    ~SmallFunction()
+    {
+        reset();
+    }
+
+    ALWAYS_INLINE void operator()()
+    {
+        if (UNLIKELY(!ops_))
+            throw std::bad_function_call();
+        ops_->call(&storage_);
+    }
+
+    ALWAYS_INLINE explicit operator bool() const noexcept { return ops_ != nullptr; }
+
+    void swap(SmallFunction & other) noexcept
+    {
+        SmallFunction tmp(std::move(other));
+        other = std::move(*this);
+        *this = std::move(tmp);
+    }
+
+private:
+    void reset()
+    {
+        if (ops_) {
+            Ops const* ops = ops_;
+            ops_ = nullptr;
+            ops->destroy(&storage_);
+        }
+    }
+
+    template <typename F, typename Function>
+    void init(Function && f, std::true_type)
+    {
+        new (&storage_) F(std::forward<Function>(f));
+        ops_ = InlineOps<F>::ops();
+    }
+
+    template <typename F, typename Function>
+    void init(Function && f, std::false_type)
+    {
+        *reinterpret_cast<F**>(&storage_) = new F(std::forward<Function>(f));
+        ops_ = HeapOps<F>::ops();
+    }
+
+private:
+    Storage storage_;
+    Ops const* ops_ = nullptr;
+};
+
+} // namespace co
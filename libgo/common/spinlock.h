@@ -5,6 +5,16 @@
 namespace co
 {
 
+// 自旋等待时让出流水线资源
+ALWAYS_INLINE void CpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __asm__ __volatile__("pause");
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
 struct BooleanFakeLock
 {
     bool locked_ = false;
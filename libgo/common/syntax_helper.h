@@ -9,6 +9,10 @@ enum {
     opt_stack_size,
     opt_dispatch,
     opt_affinity,
+    opt_priority,
+    opt_deadline,
+    opt_processer,
+    opt_shared_stack,
 };
 
 template <int OptType>
@@ -36,45 +40,180 @@ struct __go_option<opt_affinity>
     explicit __go_option(bool affinity) : affinity_(affinity) {}
 };
 
-struct __go
+template <>
+struct __go_option<opt_priority>
+{
+    uint8_t priority_;
+    explicit __go_option(int priority)
+        : priority_((uint8_t)(std::min)((std::max)(priority, (int)prio_high), (int)prio_low)) {}
+};
+
+template <>
+struct __go_option<opt_deadline>
+{
+    FastSteadyClock::time_point deadline_;
+    explicit __go_option(FastSteadyClock::time_point tp) : deadline_(tp) {}
+
+    template <typename Clock, typename Duration>
+    explicit __go_option(std::chrono::time_point<Clock, Duration> const& tp)
+        : deadline_(FastSteadyClock::now() + std::chrono::duration_cast<FastSteadyClock::duration>(tp - Clock::now())) {}
+};
+
+template <>
+struct __go_option<opt_processer>
 {
-    __go(const char* file, int lineno)
+    int processer_;
+    explicit __go_option(int idx) : processer_(idx) {}
+};
+
+template <>
+struct __go_option<opt_shared_stack>
+{
+    bool sharedStack_;
+    explicit __go_option(bool enable) : sharedStack_(enable) {}
+};
+
+template <typename T>
+struct __is_go_option : std::false_type {};
+
+template <int OptType>
+struct __is_go_option<__go_option<OptType>> : std::true_type {};
+
+// 协程函数以外的参数(go option)不走完美转发版本的operator-
+template <typename Function>
+using __enable_if_go_function = typename std::enable_if<
+    !__is_go_option<typename std::decay<Function>::type>::value>::type;
+
+// go/go_batch共用的选项处理
+template <typename Derived>
+struct __go_options
+{
+    __go_options(const char* file, int lineno)
     {
         scheduler_ = nullptr;
         opt_.file_ = file;
         opt_.lineno_ = lineno;
     }
 
-    template <typename Function>
-    ALWAYS_INLINE void operator-(Function const& f)
+    ALWAYS_INLINE Derived& operator-(__go_option<opt_scheduler> const& opt)
+    {
+        scheduler_ = opt.scheduler_;
+        return self();
+    }
+
+    ALWAYS_INLINE Derived& operator-(__go_option<opt_stack_size> const& opt)
+    {
+        opt_.stack_size_ = opt.stack_size_;
+        return self();
+    }
+
+    ALWAYS_INLINE Derived& operator-(__go_option<opt_affinity> const& opt)
+    {
+        opt_.affinity_ = opt.affinity_;
+        return self();
+    }
+
+    ALWAYS_INLINE Derived& operator-(__go_option<opt_priority> const& opt)
+    {
+        opt_.priority_ = opt.priority_;
+        return self();
+    }
+
+    ALWAYS_INLINE Derived& operator-(__go_option<opt_deadline> const& opt)
+    {
+        opt_.deadline_ = opt.deadline_;
+        return self();
+    }
+
+    ALWAYS_INLINE Derived& operator-(__go_option<opt_processer> const& opt)
+    {
+        opt_.processer_ = opt.processer_;
+        return self();
+    }
+
+    ALWAYS_INLINE Derived& operator-(__go_option<opt_shared_stack> const& opt)
+    {
+        opt_.sharedStack_ = opt.sharedStack_;
+        return self();
+    }
+
+    ALWAYS_INLINE Scheduler* scheduler()
     {
         if (!scheduler_) scheduler_ = Processer::GetCurrentScheduler();
         if (!scheduler_) scheduler_ = &Scheduler::getInstance();
-        scheduler_->CreateTask(f, opt_);
+        return scheduler_;
     }
 
-    ALWAYS_INLINE __go& operator-(__go_option<opt_scheduler> const& opt)
+    ALWAYS_INLINE Derived& self() { return static_cast<Derived&>(*this); }
+
+    TaskOpt opt_;
+    Scheduler* scheduler_;
+};
+
+struct __go : public __go_options<__go>
+{
+    __go(const char* file, int lineno) : __go_options<__go>(file, lineno) {}
+
+    using __go_options<__go>::operator-;
+
+    template <typename Function, typename = __enable_if_go_function<Function>>
+    ALWAYS_INLINE void operator-(Function && f)
     {
-        scheduler_ = opt.scheduler_;
-        return *this;
+        scheduler()->CreateTask(TaskF(std::forward<Function>(f)), opt_);
+    }
+};
+
+// 批量创建n个协程, 协程函数的参数是下标(0 ~ n-1)
+// 每个协程持有可调用对象的一份拷贝, mutable的可调用对象在各协程中互不影响.
+struct __go_batch : public __go_options<__go_batch>
+{
+    __go_batch(const char* file, int lineno, std::size_t n)
+        : __go_options<__go_batch>(file, lineno), n_(n) {}
+
+    using __go_options<__go_batch>::operator-;
+
+    template <typename Function, typename = __enable_if_go_function<Function>>
+    ALWAYS_INLINE void operator-(Function const& f)
+    {
+        std::vector<TaskF> fns;
+        fns.reserve(n_);
+        Function fn(f);     // 按值捕获const引用得到的是const拷贝, 先拷贝一份非const的
+        for (std::size_t i = 0; i < n_; ++i)
+            fns.emplace_back([fn, i]() mutable { fn(i); });
+        scheduler()->CreateTasks(std::move(fns), opt_);
     }
 
-    ALWAYS_INLINE __go& operator-(__go_option<opt_stack_size> const& opt)
+    std::size_t n_;
+};
+
+// 轻量任务(go_light)
+struct __go_light
+{
+    __go_light() : scheduler_(nullptr) {}
+
+    template <typename Function, typename = __enable_if_go_function<Function>>
+    ALWAYS_INLINE void operator-(Function && f)
     {
-        opt_.stack_size_ = opt.stack_size_;
-        return *this;
+        if (!scheduler_) scheduler_ = Processer::GetCurrentScheduler();
+        if (!scheduler_) scheduler_ = &Scheduler::getInstance();
+        scheduler_->Post(TaskF(std::forward<Function>(f)));
     }
 
-    ALWAYS_INLINE __go& operator-(__go_option<opt_affinity> const& opt)
+    ALWAYS_INLINE __go_light& operator-(__go_option<opt_scheduler> const& opt)
     {
-        opt_.affinity_ = opt.affinity_;
+        scheduler_ = opt.scheduler_;
         return *this;
     }
 
-    TaskOpt opt_;
     Scheduler* scheduler_;
 };
 
+template <typename Function>
+ALWAYS_INLINE void post(Function && f)
+{
+    __go_light()-std::forward<Function>(f);
+}
+
 //template <typename R>
 //struct __async_wait
 //{
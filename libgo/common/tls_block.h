@@ -0,0 +1,68 @@
+#pragma once
+#include "config.h"
+
+// 热路径使用的线程局部变量.
+// linux下使用initial-exec模型: 访问只是一次基于fs(x86_64)/tpidr_el0(aarch64)的load,
+// 不会像-fPIC编译的thread_local那样每次调用__tls_get_addr.
+// 代价是libgo编译成动态库时不能在程序运行中途dlopen加载(静态TLS空间可能不足).
+#if defined(LIBGO_SYS_Linux)
+# define LIBGO_TLS_INITIAL_EXEC __thread __attribute__((tls_model("initial-exec")))
+#elif defined(LIBGO_SYS_Windows)
+# define LIBGO_TLS_INITIAL_EXEC __declspec(thread)
+#else
+# define LIBGO_TLS_INITIAL_EXEC __thread
+#endif
+
+namespace co
+{
+
+class Processer;
+struct Task;
+
+// 每次协程切换、每个hook函数都要访问的线程状态, 集中放在同一个缓存行中
+struct alignas(64) TlsBlock
+{
+    // 当前线程正在运行的调度器(P)
+    Processer* proc_;
+
+    // 当前线程正在执行的协程, 不在协程中时为nullptr
+    Task* task_;
+
+    // 调度器的上下文(fcontext_t), 协程切出时跳回这里
+    void* schedCtx_;
+};
+
+} // namespace co
+
+extern "C" LIBGO_TLS_INITIAL_EXEC co::TlsBlock libgo_tls_block;
+
+namespace co
+{
+
+// 协程可能在另一个线程上恢复执行, 而编译器认为线程指针在函数内不会改变,
+// 可能把切换前算好的TLS地址留到切换后继续使用. 这里用volatile汇编每次重新读取线程指针.
+ALWAYS_INLINE TlsBlock& GetTlsBlock()
+{
+#if defined(LIBGO_SYS_Linux) && defined(__x86_64__)
+    TlsBlock* p;
+    __asm__ __volatile__ (
+        "movq libgo_tls_block@gottpoff(%%rip), %0\n\t"
+        "addq %%fs:0, %0\n\t"
+        : "=r"(p));
+    return *p;
+#elif defined(LIBGO_SYS_Linux) && defined(__aarch64__)
+    TlsBlock* p;
+    uintptr_t off;
+    __asm__ __volatile__ (
+        "mrs %0, tpidr_el0\n\t"
+        "adrp %1, :gottprel:libgo_tls_block\n\t"
+        "ldr %1, [%1, #:gottprel_lo12:libgo_tls_block]\n\t"
+        "add %0, %0, %1\n\t"
+        : "=r"(p), "=&r"(off));
+    return *p;
+#else
+    return libgo_tls_block;
+#endif
+}
+
+} // namespace co
@@ -169,6 +169,28 @@ public:
         DecrementRef(ptr);
 //        printf("SList.erase done\n");
     }
+    // 追加到尾部, 链表持有元素的一个引用
+    void push_back(T* ptr)
+    {
+        assert(ptr->prev == nullptr && ptr->next == nullptr);
+        if (tail_) tail_->link(ptr);
+        else head_ = ptr;
+        tail_ = ptr;
+        ++ count_;
+        IncrementRef(ptr);
+    }
+    // 摘下首元素, 不修改引用计数(引用随元素一起转移给调用者)
+    T* pop_front()
+    {
+        if (empty()) return nullptr;
+        T* ptr = head_;
+        head_ = (T*)ptr->next;
+        if (head_) head_->prev = nullptr;
+        else tail_ = nullptr;
+        ptr->prev = ptr->next = nullptr;
+        -- count_;
+        return ptr;
+    }
     std::size_t size() const
     {
         return count_;
@@ -319,6 +341,10 @@ public:
     {
         if (head_ == tail_) return SList<T>();
         LockGuard lock(*lock_);
+        return pop_frontWithoutLock(n);
+    }
+    ALWAYS_INLINE SList<T> pop_frontWithoutLock(uint32_t n)
+    {
         if (head_ == tail_) return SList<T>();
         TSQueueHook* first = head_->next;
         TSQueueHook* last = first;
@@ -389,6 +415,43 @@ public:
         return SList<T>(first, last, c);
     }
 
+    // 从队尾(fromBack=false时从队首)开始摘下至多n个满足pred的元素, 保持原有顺序. O(n), 慎用.
+    template <typename Pred>
+    ALWAYS_INLINE SList<T> pop_if(std::size_t n, Pred const& pred, bool fromBack = true)
+    {
+        if (head_ == tail_) return SList<T>();
+        LockGuard lock(*lock_);
+        return pop_ifWithoutLock(n, pred, fromBack);
+    }
+    template <typename Pred>
+    ALWAYS_INLINE SList<T> pop_ifWithoutLock(std::size_t n, Pred const& pred, bool fromBack = true)
+    {
+        SList<T> result;
+        TSQueueHook* pos = fromBack ? tail_ : head_->next;
+        while (pos && pos != head_ && result.size() < n) {
+            TSQueueHook* next = fromBack ? pos->prev : pos->next;
+            if (pred((T*)pos)) {
+                pos->prev->next = pos->next;
+                if (pos->next) pos->next->prev = pos->prev;
+                else tail_ = pos->prev;
+                pos->prev = pos->next = nullptr;
+#if LIBGO_DEBUG
+                pos->check_ = nullptr;
+#endif
+                -- count_;
+                SList<T> one(pos, pos, 1);
+                if (fromBack) {
+                    one.append(std::move(result));
+                    result = std::move(one);
+                } else {
+                    result.append(std::move(one));
+                }
+            }
+            pos = next;
+        }
+        return result;
+    }
+
     ALWAYS_INLINE bool erase(T* hook, bool check = false)
     {
         LockGuard lock(*lock_);
@@ -431,6 +494,30 @@ public:
         return count_;
     }
 
+    // 有序插入: 从队尾向前找到第一个不大于element的元素, 插在它后面. O(n), 慎用.
+    template <typename Less>
+    ALWAYS_INLINE size_t insertSortedWithoutLock(T* element, Less const& less, bool refCount = true)
+    {
+        TSQueueHook *hook = static_cast<TSQueueHook*>(element);
+        assert(hook->next == nullptr);
+        assert(hook->prev == nullptr);
+        TSQueueHook *pos = tail_;
+        while (pos != head_ && less(element, (T*)pos))
+            pos = pos->prev;
+        if (pos == tail_)
+            return pushWithoutLock(element, refCount);
+
+        hook->prev = pos;
+        hook->next = pos->next;
+        pos->next->prev = hook;
+        pos->next = hook;
+        hook->check_ = check_;
+        ++ count_;
+        if (refCount)
+            IncrementRef(element);
+        return count_;
+    }
+
     ALWAYS_INLINE size_t push(T* element)
     {
         LockGuard lock(*lock_);
@@ -1,30 +1,112 @@
 #pragma once
 #include "../common/config.h"
+#include "../common/tls_block.h"
 #include "fcontext.h"
+#include "fast_fcontext.h"
+#include "stack_arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+namespace co {
+struct SharedStackTag {};
+} // namespace co
 
 #if defined(LIBGO_SYS_Windows)
 # include "fiber/context.h"
 #else
 namespace co {
 
+class Context;
+
+
+// 共享栈: 每个P一个, 共享栈模式的协程都在这块栈上运行.
+// 协程被换出时并不立即保存栈数据, 直到另一个协程要使用这块栈时, 才把原占用者的栈拷贝到它私有的缓冲区中.
+struct SharedStack
+{
+    char* stack_ = nullptr;
+    uint32_t stackSize_ = 0;
+    int protectPage_ = 0;
+    Context* occupant_ = nullptr;   // 当前栈上保存着谁的数据
+
+    explicit SharedStack(uint32_t stackSize) : stackSize_(stackSize) {}
+    ~SharedStack()
+    {
+        if (stack_) {
+            if (protectPage_)
+                StackTraits::UnprotectStack(stack_, protectPage_);
+            StackTraits::FreeFunc()(stack_);
+            stack_ = NULL;
+        }
+    }
+
+    // 首次使用时才分配
+    ALWAYS_INLINE void Init()
+    {
+        if (stack_) return ;
+        stack_ = (char*)StackTraits::MallocFunc()(stackSize_);
+        DebugPrint(dbg_task, "valloc shared stack. size=%u ptr=%p",
+                stackSize_, stack_);
+
+        int protectPage = StackTraits::GetProtectStackPageSize();
+        if (protectPage && StackTraits::ProtectStack(stack_, stackSize_, protectPage))
+            protectPage_ = protectPage;
+    }
+
+    ALWAYS_INLINE char* Top() { return stack_ + stackSize_; }
+
+    SharedStack(SharedStack const&) = delete;
+    SharedStack& operator=(SharedStack const&) = delete;
+};
+
 class Context
 {
 public:
     Context(fn_t fn, intptr_t vp, std::size_t stackSize)
         : fn_(fn), vp_(vp), stackSize_(stackSize)
     {
+        if (StackArena::IsEnabled()) {
+            // 内存池中的栈已经放置好了保护页
+            std::size_t size = stackSize_;
+            stack_ = StackArena::getInstance().Allocate(size, sampled_);
+            stackSize_ = (uint32_t)size;
+            arena_ = true;
+            ctx_ = MakeFContext(stack_ + stackSize_, stackSize_, fn_);
+            return ;
+        }
+
         stack_ = (char*)StackTraits::MallocFunc()(stackSize_);
         DebugPrint(dbg_task, "valloc stack. size=%u ptr=%p",
                 stackSize_, stack_);
 
-        ctx_ = libgo_make_fcontext(stack_ + stackSize_, stackSize_, fn_);
+        ctx_ = MakeFContext(stack_ + stackSize_, stackSize_, fn_);
 
         int protectPage = StackTraits::GetProtectStackPageSize();
         if (protectPage && StackTraits::ProtectStack(stack_, stackSize_, protectPage))
             protectPage_ = protectPage;
     }
+
+    // 共享栈模式: 不分配私有栈, 首次运行时在P的共享栈上创建上下文.
+    // stack_/stackSize_用作换出时保存栈数据的缓冲区.
+    Context(fn_t fn, intptr_t vp, SharedStackTag)
+        : ctx_(nullptr), fn_(fn), vp_(vp), sharedMode_(true)
+    {
+    }
+
     ~Context()
     {
+        if (sharedMode_) {
+            free(stack_);
+            stack_ = NULL;
+            return ;
+        }
+
+        if (arena_) {
+            StackArena::getInstance().Free(stack_, stackSize_);
+            stack_ = NULL;
+            return ;
+        }
+
         if (stack_) {
             DebugPrint(dbg_task, "free stack. ptr=%p", stack_);
             if (protectPage_)
@@ -34,25 +116,87 @@ public:
         }
     }
 
+    ALWAYS_INLINE bool IsSharedStack() const { return sharedMode_; }
+
+    // 切换进协程, 共享栈模式的协程在ss上运行.
+    // 同一个协程每次都必须使用同一个ss(栈上的指针都指向这块内存), 所以共享栈协程不能迁移到其他P.
+    ALWAYS_INLINE void SwapIn(SharedStack & ss)
+    {
+        if (!sharedMode_)
+            return SwapIn();
+
+        if (ss.occupant_ != this) {
+            ss.Init();
+            if (ss.occupant_)
+                ss.occupant_->SaveSharedStack(ss);
+            ss.occupant_ = this;
+
+            if (!ctx_)
+                ctx_ = MakeFContext(ss.Top(), ss.stackSize_, fn_);
+            else
+                RestoreSharedStack(ss);
+        }
+
+        JumpFContext(&GetTlsContext(), ctx_, vp_);
+    }
+
+    // 协程结束后释放对共享栈的占用, 下一个使用者无需保存它的数据
+    ALWAYS_INLINE void ReleaseSharedStack(SharedStack & ss)
+    {
+        if (ss.occupant_ == this)
+            ss.occupant_ = nullptr;
+    }
+
+    // 栈是否参与使用量采样(stack_usage_sample)
+    ALWAYS_INLINE bool IsStackSampled() const { return sampled_; }
+
+    // 栈的最大使用深度, 只对采样的栈有效
+    uint32_t StackHighWater()
+    {
+        return sampled_ ? StackArena::getInstance().HighWater(stack_, stackSize_) : 0;
+    }
+
+    // 换出时保存的栈数据长度(共享栈模式), 用于统计
+    ALWAYS_INLINE uint32_t SavedStackSize() const { return savedSize_; }
+
     ALWAYS_INLINE void SwapIn()
     {
-        libgo_jump_fcontext(&GetTlsContext(), ctx_, vp_);
+        JumpFContext(&GetTlsContext(), ctx_, vp_);
     }
 
     ALWAYS_INLINE void SwapTo(Context & other)
     {
-        libgo_jump_fcontext(&ctx_, other.ctx_, other.vp_);
+        JumpFContext(&ctx_, other.ctx_, other.vp_);
     }
 
     ALWAYS_INLINE void SwapOut()
     {
-        libgo_jump_fcontext(&ctx_, GetTlsContext(), 0);
+        JumpFContext(&ctx_, GetTlsContext(), 0);
+    }
+
+    ALWAYS_INLINE fcontext_t& GetTlsContext()
+    {
+        return GetTlsBlock().schedCtx_;
+    }
+
+private:
+    // 把栈上[ctx_, 栈底)这段正在使用的数据拷贝出来, 缓冲区按实际使用量分配
+    void SaveSharedStack(SharedStack & ss)
+    {
+        std::size_t size = ss.Top() - (char*)ctx_;
+        if (size > stackSize_ || size * 4 < stackSize_) {
+            free(stack_);
+            stackSize_ = (uint32_t)((size + 255) & ~(std::size_t)255);
+            stack_ = (char*)malloc(stackSize_);
+        }
+        memcpy(stack_, ctx_, size);
+        savedSize_ = (uint32_t)size;
     }
 
-    fcontext_t& GetTlsContext()
+    // 恢复到原来的地址上, 栈内的指针依然有效
+    void RestoreSharedStack(SharedStack & ss)
     {
-        static thread_local fcontext_t tls_context;
-        return tls_context;
+        memcpy(ss.Top() - savedSize_, stack_, savedSize_);
     }
 
 private:
@@ -62,6 +206,10 @@ private:
     char* stack_ = nullptr;
     uint32_t stackSize_ = 0;
     int protectPage_ = 0;
+    uint32_t savedSize_ = 0;
+    bool sharedMode_ = false;
+    bool arena_ = false;        // 栈来自StackArena
+    bool sampled_ = false;
 };
 } // namespace co
 
@@ -0,0 +1,130 @@
+#pragma once
+#include "../common/config.h"
+#include "fcontext.h"
+
+// 快速上下文切换 (x86_64 / aarch64, linux, gcc/clang)
+// boost.context的jump_fcontext是一个独立的汇编函数, 每次切换都要保存全部callee-saved寄存器,
+// 并检查preserve_fpu标志.
+// 这里用内联汇编实现切换: 只在栈上保存恢复点和帧指针, 其他寄存器通过clobber列表告诉编译器,
+// 由编译器只保存切换点上真正活跃的值. MXCSR/x87控制字不保存(和preserve_fpu=false一致),
+// 协程中修改浮点环境的话需要自己恢复.
+//
+// 两种实现的栈布局不同, 同一个上下文必须始终使用同一组make/jump函数.
+// 编译时关闭ENABLE_FAST_CONTEXT可以退回到boost.context的实现.
+// aarch64的实现还没有在aarch64上跑过测试, 默认不启用, 需要用ENABLE_FAST_CONTEXT_AARCH64显式打开.
+#if ENABLE_FAST_CONTEXT && defined(LIBGO_SYS_Linux) && \
+    (defined(__x86_64__) || (defined(__aarch64__) && ENABLE_FAST_CONTEXT_AARCH64))
+# define LIBGO_FAST_CONTEXT 1
+#else
+# define LIBGO_FAST_CONTEXT 0
+#endif
+
+namespace co
+{
+
+#if LIBGO_FAST_CONTEXT
+// 协程函数返回后跳到这里 (和boost.context的行为一致)
+extern "C" void libgo_fast_fcontext_finish();
+
+# if defined(__x86_64__)
+// 新上下文的栈: [rbp = 0][恢复点 = fn][fn的返回地址 = finish]
+ALWAYS_INLINE fcontext_t MakeFContext(void* stackTop, std::size_t, fn_t fn)
+{
+    uintptr_t* sp = (uintptr_t*)((uintptr_t)stackTop & ~(uintptr_t)15);
+    *--sp = (uintptr_t)&libgo_fast_fcontext_finish;
+    *--sp = (uintptr_t)fn;
+    *--sp = 0;
+    return (fcontext_t)sp;
+}
+
+// 跳过red zone后压入恢复点和rbp, 保存栈指针, 切换到对方的栈上弹出它的rbp和恢复点.
+// vp通过rdi传递: 对新上下文来说是协程函数的第一个参数, 对恢复的一方来说是返回值.
+// 注意: 不能用局部寄存器变量绑定参数, 编译器可能在赋值和asm之间插入__tls_get_addr等调用破坏它们.
+ALWAYS_INLINE intptr_t JumpFContext(fcontext_t* ofc, fcontext_t nfc, intptr_t vp)
+{
+    __asm__ __volatile__ (
+        "leaq -128(%%rsp), %%rsp\n\t"
+        "leaq 1f(%%rip), %%rax\n\t"
+        "pushq %%rax\n\t"
+        "pushq %%rbp\n\t"
+        "movq %%rsp, (%%rsi)\n\t"
+        "movq %%rdx, %%rsp\n\t"
+        "popq %%rbp\n\t"
+        "popq %%rcx\n\t"
+        "jmp *%%rcx\n\t"
+        "1:\n\t"
+        "leaq 128(%%rsp), %%rsp\n\t"
+        : "+D"(vp), "+S"(ofc), "+d"(nfc)
+        :
+        : "rax", "rbx", "rcx", "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15",
+          "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7",
+          "xmm8", "xmm9", "xmm10", "xmm11", "xmm12", "xmm13", "xmm14", "xmm15",
+#  if defined(__AVX512F__)
+          "xmm16", "xmm17", "xmm18", "xmm19", "xmm20", "xmm21", "xmm22", "xmm23",
+          "xmm24", "xmm25", "xmm26", "xmm27", "xmm28", "xmm29", "xmm30", "xmm31",
+          "k0", "k1", "k2", "k3", "k4", "k5", "k6", "k7",
+#  endif
+          "st", "st(1)", "st(2)", "st(3)", "st(4)", "st(5)", "st(6)", "st(7)",
+          "memory", "cc");
+    return vp;
+}
+# else // __aarch64__
+// 新上下文的栈: [x29 = 0][x30 = finish][恢复点 = fn][对齐]
+ALWAYS_INLINE fcontext_t MakeFContext(void* stackTop, std::size_t, fn_t fn)
+{
+    uintptr_t* sp = (uintptr_t*)((uintptr_t)stackTop & ~(uintptr_t)15);
+    sp -= 4;
+    sp[0] = 0;
+    sp[1] = (uintptr_t)&libgo_fast_fcontext_finish;
+    sp[2] = (uintptr_t)fn;
+    sp[3] = 0;
+    return (fcontext_t)sp;
+}
+
+// 保存x29/x30和恢复点, 用x16跳转(开启BTI时可以落在函数入口的bti c上), 恢复点用bti j标记.
+// aarch64没有指定单个寄存器的约束, 参数都通过内存操作数传递(基址是sp或x29, 切换回来时都已恢复),
+// x0~x28/x30全部在clobber列表里, 这样汇编里可以随意使用x0传递vp, 不依赖编译器的寄存器分配.
+// x29不能出现在clobber列表中, 由汇编自己保存恢复.
+ALWAYS_INLINE intptr_t JumpFContext(fcontext_t* ofc, fcontext_t nfc, intptr_t vp)
+{
+    __asm__ __volatile__ (
+        "ldr x16, %1\n\t"
+        "ldr x17, %2\n\t"
+        "ldr x0, %0\n\t"
+        "adr x15, 1f\n\t"
+        "sub sp, sp, #32\n\t"
+        "stp x29, x30, [sp]\n\t"
+        "str x15, [sp, #16]\n\t"
+        "mov x15, sp\n\t"
+        "str x15, [x16]\n\t"
+        "mov sp, x17\n\t"
+        "ldp x29, x30, [sp]\n\t"
+        "ldr x16, [sp, #16]\n\t"
+        "add sp, sp, #32\n\t"
+        "br x16\n\t"
+        "1:\n\t"
+        "hint #36\n\t"
+        "str x0, %0\n\t"
+        : "+m"(vp)
+        : "m"(ofc), "m"(nfc)
+        : "x0", "x1", "x2", "x3", "x4", "x5", "x6", "x7", "x8", "x9", "x10", "x11", "x12", "x13", "x14", "x15",
+          "x16", "x17", "x18", "x19", "x20", "x21", "x22", "x23", "x24", "x25", "x26", "x27", "x28", "x30",
+          "v0", "v1", "v2", "v3", "v4", "v5", "v6", "v7", "v8", "v9", "v10", "v11", "v12", "v13", "v14", "v15",
+          "v16", "v17", "v18", "v19", "v20", "v21", "v22", "v23", "v24", "v25", "v26", "v27", "v28", "v29", "v30", "v31",
+          "memory", "cc");
+    return vp;
+}
+# endif
+#else // LIBGO_FAST_CONTEXT
+ALWAYS_INLINE fcontext_t MakeFContext(void* stackTop, std::size_t size, fn_t fn)
+{
+    return libgo_make_fcontext(stackTop, size, fn);
+}
+
+ALWAYS_INLINE intptr_t JumpFContext(fcontext_t* ofc, fcontext_t nfc, intptr_t vp)
+{
+    return libgo_jump_fcontext(ofc, nfc, vp);
+}
+#endif // LIBGO_FAST_CONTEXT
+
+} // namespace co
@@ -2,8 +2,11 @@
 #include <memory>
 #include <string.h>
 
+#include "fast_fcontext.h"
+
 #if defined(LIBGO_SYS_Unix)
 #include <sys/mman.h>
+#include <unistd.h>
 #endif
 
 namespace co
@@ -67,5 +70,12 @@ namespace co
     }
 #endif //defined(LIBGO_SYS_Unix)
 
+#if LIBGO_FAST_CONTEXT
+    extern "C" void libgo_fast_fcontext_finish()
+    {
+        _exit(0);
+    }
+#endif
+
 } //namespace co
 
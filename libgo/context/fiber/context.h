@@ -25,6 +25,12 @@ namespace co {
         }
     };
 
+    // fiber不支持共享栈, 共享栈模式的协程退化为使用私有栈
+    struct SharedStack
+    {
+        explicit SharedStack(uint32_t) {}
+    };
+
     class Context
     {
     public:
@@ -41,11 +47,31 @@ namespace co {
                 return;
             }
         }
+        Context(fn_t fn, intptr_t vp, SharedStackTag)
+            : Context(fn, vp, CoroutineOptions::getInstance().stack_size)
+        {
+        }
+
         ~Context()
         {
             DeleteFiber(ctx_);
         }
 
+        ALWAYS_INLINE bool IsSharedStack() const { return false; }
+
+        ALWAYS_INLINE void SwapIn(SharedStack &)
+        {
+            SwapIn();
+        }
+
+        ALWAYS_INLINE void ReleaseSharedStack(SharedStack &) {}
+
+        ALWAYS_INLINE uint32_t SavedStackSize() const { return 0; }
+
+        ALWAYS_INLINE bool IsStackSampled() const { return false; }
+
+        ALWAYS_INLINE uint32_t StackHighWater() { return 0; }
+
         ALWAYS_INLINE void SwapIn()
         {
             SwitchToFiber(ctx_);
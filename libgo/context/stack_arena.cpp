@@ -0,0 +1,190 @@
+#include "stack_arena.h"
+#include "fcontext.h"
+#include <new>
+#include <atomic>
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+
+#if defined(LIBGO_SYS_Linux)
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+namespace co
+{
+
+// 每次预留的虚拟内存大小, 至少容纳16个栈
+static const std::size_t kRegionBytes = 64 * 1024 * 1024;
+static const std::size_t kMinRegionStacks = 16;
+
+StackArena& StackArena::getInstance()
+{
+    static StackArena obj;
+    return obj;
+}
+
+bool StackArena::IsEnabled()
+{
+#if defined(LIBGO_SYS_Linux)
+    return CoroutineOptions::getInstance().stack_arena;
+#else
+    return false;
+#endif
+}
+
+StackArena::StackArena()
+{
+#if defined(LIBGO_SYS_Linux)
+    pageSize_ = (std::size_t)sysconf(_SC_PAGESIZE);
+#else
+    pageSize_ = 4096;
+#endif
+}
+
+#if defined(LIBGO_SYS_Linux)
+char* StackArena::Allocate(std::size_t & size, bool & sampled)
+{
+    size = (size + pageSize_ - 1) & ~(pageSize_ - 1);
+    uint32_t sample = CoroutineOptions::getInstance().stack_usage_sample;
+
+    std::unique_lock<std::mutex> lock(mtx_);
+    Pool & pool = pools_[size];
+    sampled = sample && (pool.allocCount_++ % sample == 0);
+
+    char* stack = nullptr;
+    if (!pool.free_.empty()) {
+        stack = pool.free_.back();
+        pool.free_.pop_back();
+        lock.unlock();
+
+        // 回收时用的是MADV_FREE, 内容不一定已经清零. 采样的栈需要从全0开始
+        if (sampled)
+            madvise(stack, size, MADV_DONTNEED);
+        return stack;
+    }
+
+    // 保护页数量在第一次预留时确定, 之后不再改变
+    if (!pool.end_)
+        pool.guard_ = (std::size_t)CoroutineOptions::getInstance().stack_arena_guard_pages * pageSize_;
+    std::size_t guard = pool.guard_;
+    std::size_t slot = guard + size;
+
+    if (pool.cursor_ == pool.end_) {
+        // 只预留虚拟地址, 物理内存在首次访问时才提交
+        std::size_t count = (std::max)(kMinRegionStacks, kRegionBytes / slot);
+        void* region = mmap(nullptr, slot * count, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (region == MAP_FAILED) {
+            DebugPrint(dbg_task, "stack arena reserve failed. size=%lu error=%s",
+                    (unsigned long)(slot * count), strerror(errno));
+            throw std::bad_alloc();
+        }
+
+        DebugPrint(dbg_task, "stack arena reserve. stack_size=%lu count=%lu ptr=%p",
+                (unsigned long)size, (unsigned long)count, region);
+        pool.cursor_ = (char*)region;
+        pool.end_ = pool.cursor_ + slot * count;
+    }
+
+    char* base = pool.cursor_;
+    pool.cursor_ += slot;
+    lock.unlock();
+
+    // 保护页只在栈第一次使用时设置一次, 之后随栈一起复用
+    if (guard && -1 == mprotect(base, guard, PROT_NONE)) {
+        DebugPrint(dbg_task, "stack arena protect guard page failed. ptr=%p error=%s",
+                base, strerror(errno));
+    }
+
+    return base + guard;
+}
+
+void StackArena::Free(char* stack, std::size_t size)
+{
+    Release(stack, size);
+
+    std::unique_lock<std::mutex> lock(mtx_);
+    pools_[size].free_.push_back(stack);
+}
+
+void StackArena::Release(char* stack, std::size_t size)
+{
+    // MADV_FREE: 内存紧张时内核才真正回收, 回收前再次写入不会产生缺页.
+    // 内核不支持时(4.5以前)退化为MADV_DONTNEED.
+#if defined(MADV_FREE)
+    static std::atomic<int> advice{MADV_FREE};
+#else
+    static std::atomic<int> advice{MADV_DONTNEED};
+#endif
+    int adv = advice.load(std::memory_order_relaxed);
+    if (-1 == madvise(stack, size, adv) && errno == EINVAL && adv != MADV_DONTNEED) {
+        advice.store(MADV_DONTNEED, std::memory_order_relaxed);
+        madvise(stack, size, MADV_DONTNEED);
+    }
+}
+
+uint32_t StackArena::HighWater(char* stack, std::size_t size)
+{
+    // 从栈的低地址一端找到第一个驻留内存的页, 再在页内找到第一个非0的字
+    std::size_t pages = size / pageSize_;
+    std::vector<unsigned char> resident(pages);
+    if (-1 == mincore(stack, size, resident.data()))
+        return 0;
+
+    for (std::size_t i = 0; i < pages; ++i) {
+        if (!(resident[i] & 1))
+            continue;
+
+        const uintptr_t* p = (const uintptr_t*)(stack + i * pageSize_);
+        const uintptr_t* end = (const uintptr_t*)(stack + size);
+        while (p < end && *p == 0)
+            ++p;
+        return (uint32_t)((const char*)end - (const char*)p);
+    }
+
+    return 0;
+}
+#else //defined(LIBGO_SYS_Linux)
+char* StackArena::Allocate(std::size_t & size, bool & sampled)
+{
+    sampled = false;
+    return (char*)StackTraits::MallocFunc()(size);
+}
+
+void StackArena::Free(char* stack, std::size_t size)
+{
+    StackTraits::FreeFunc()(stack);
+}
+
+void StackArena::Release(char* stack, std::size_t size)
+{
+}
+
+uint32_t StackArena::HighWater(char* stack, std::size_t size)
+{
+    return 0;
+}
+#endif //defined(LIBGO_SYS_Linux)
+
+void StackArena::RecordUsage(SourceLocation const& location, uint32_t bytes)
+{
+    std::unique_lock<std::mutex> lock(statMtx_);
+    StackUsageStat & stat = stats_[location];
+    stat.location_ = location;
+    ++stat.samples_;
+    stat.totalBytes_ += bytes;
+    stat.maxBytes_ = (std::max)(stat.maxBytes_, bytes);
+}
+
+std::vector<StackUsageStat> StackArena::GetUsageStats()
+{
+    std::vector<StackUsageStat> result;
+    std::unique_lock<std::mutex> lock(statMtx_);
+    result.reserve(stats_.size());
+    for (auto & kv : stats_)
+        result.push_back(kv.second);
+    return result;
+}
+
+} // namespace co
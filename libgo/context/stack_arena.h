@@ -0,0 +1,72 @@
+#pragma once
+#include "../common/config.h"
+#include "../common/util.h"
+#include <mutex>
+#include <map>
+#include <vector>
+
+namespace co
+{
+
+// 按创建协程的代码位置统计的栈使用量(采样)
+struct StackUsageStat
+{
+    SourceLocation location_;
+    uint64_t samples_ = 0;
+    uint64_t totalBytes_ = 0;
+    uint32_t maxBytes_ = 0;
+
+    ALWAYS_INLINE uint32_t AvgBytes() const { return samples_ ? (uint32_t)(totalBytes_ / samples_) : 0; }
+};
+
+// 协程栈内存池(仅linux下有效)
+// 按栈大小分组, 一次预留一大段虚拟内存(不提交物理内存), 切分成固定大小的栈, 每个栈的底部放置保护页.
+// 物理内存在首次访问时才由内核分配; 协程结束后, 栈通过MADV_FREE把物理内存还给系统,
+// 虚拟地址和保护页留给后面的协程复用, 创建/销毁协程不再需要mprotect.
+class StackArena
+{
+public:
+    static StackArena& getInstance();
+
+    // 是否使用内存池分配协程栈 (CoroutineOptions::stack_arena)
+    static bool IsEnabled();
+
+    // 分配一个栈, size向上取整到页大小.
+    // @sampled: 这个栈是否参与栈使用量采样(采样的栈保证内容全为0, 回收时扫描得到最大深度)
+    char* Allocate(std::size_t & size, bool & sampled);
+
+    // 回收栈, size必须是Allocate返回的大小
+    void Free(char* stack, std::size_t size);
+
+    // 栈的最大使用深度(字节), 只对采样的栈有效
+    uint32_t HighWater(char* stack, std::size_t size);
+
+    // 记录一次采样结果
+    void RecordUsage(SourceLocation const& location, uint32_t bytes);
+
+    // 导出按代码位置统计的栈使用量
+    std::vector<StackUsageStat> GetUsageStats();
+
+private:
+    StackArena();
+
+    struct Pool
+    {
+        std::vector<char*> free_;       // 回收的栈(LIFO, 优先复用还在内存中的)
+        char* cursor_ = nullptr;        // 当前预留区域中未使用过的部分
+        char* end_ = nullptr;
+        std::size_t guard_ = 0;         // 每个栈的保护页大小(字节)
+        uint64_t allocCount_ = 0;
+    };
+
+    void Release(char* stack, std::size_t size);
+
+    std::size_t pageSize_;
+    std::mutex mtx_;
+    std::map<std::size_t, Pool> pools_;
+
+    std::mutex statMtx_;
+    std::map<SourceLocation, StackUsageStat> stats_;
+};
+
+} // namespace co
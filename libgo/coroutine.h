@@ -3,6 +3,7 @@
 #include "common/config.h"
 #include "common/pp.h"
 #include "common/syntax_helper.h"
+#include "common/hugepage_arena.h"
 
 #include "sync/channel.h"
 #include "sync/co_mutex.h"
@@ -16,6 +17,7 @@
 #include "defer/defer.h"
 #include "debug/listener.h"
 #include "debug/debugger.h"
+#include "debug/trace.h"
 //#include "netio/unix/errno_hook.h"
 
 #define LIBGO_VERSION 300
@@ -23,9 +25,25 @@
 #define go_alias ::co::__go(__FILE__, __LINE__)-
 #define go go_alias
 
+// 批量创建协程: go_batch(n) [](std::size_t i){ ... };
+// 每个协程得到可调用对象的一份拷贝, 支持mutable的lambda.
+#define go_batch(n) ::co::__go_batch(__FILE__, __LINE__, n)-
+
+// 轻量任务: 不单独分配协程栈, 适合不会阻塞的短小任务. 可以配合co_scheduler使用.
+#define go_light ::co::__go_light()-
+
 // create coroutine options
 #define co_stack(size) ::co::__go_option<::co::opt_stack_size>{size}-
 #define co_scheduler(pScheduler) ::co::__go_option<::co::opt_scheduler>{pScheduler}-
+#define co_priority(n) ::co::__go_option<::co::opt_priority>{n}-
+#define co_deadline(tp) ::co::__go_option<::co::opt_deadline>{tp}-
+#define co_affinity(enable) ::co::__go_option<::co::opt_affinity>{enable}-
+// 指定协程在第idx个P上运行, 并且不会被迁移到其他P.
+// P是按需创建的, idx超出当前P的数量时使用最后一个P(开启dbg_scheduler时会打印提示).
+#define co_processer(idx) ::co::__go_option<::co::opt_processer>{idx}-
+// 共享栈: 协程在P的共享栈上运行, 换出后只保留实际使用的栈, 适合海量、大部分时间在等待io的协程.
+// 共享栈协程不会被迁移到其他P; 休眠期间不要让其他协程直接访问它栈上的对象(libgo自身的同步原语已处理).
+#define co_shared_stack(enable) ::co::__go_option<::co::opt_shared_stack>{enable}-
 
 #define go_stack(size) go co_stack(size)
 
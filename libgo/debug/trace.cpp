@@ -0,0 +1,233 @@
+#include "trace.h"
+#include "../common/clock.h"
+#include "../common/tls_block.h"
+#include "../task/task.h"
+#include <stdio.h>
+#include <mutex>
+#include <memory>
+#include <vector>
+
+namespace co
+{
+
+const char* GetTraceEventName(eTraceEvent type)
+{
+    switch (type) {
+        case eTraceEvent::create:   return "create";
+        case eTraceEvent::swapIn:   return "swapIn";
+        case eTraceEvent::swapOut:  return "swapOut";
+        case eTraceEvent::suspend:  return "suspend";
+        case eTraceEvent::wakeup:   return "wakeup";
+        case eTraceEvent::steal:    return "steal";
+        case eTraceEvent::reactor:  return "reactor";
+        case eTraceEvent::timer:    return "timer";
+    }
+    return "unknown";
+}
+
+std::atomic<bool> Tracer::enabled_{false};
+
+namespace
+{
+
+// 每个线程一个的环形缓冲区, 只有所属线程写入
+struct TraceRing
+{
+    std::unique_ptr<TraceRecord[]> buf_;
+    uint64_t mask_ = 0;
+    std::atomic<uint64_t> head_{0};
+
+    // 每次Start递增, 线程写入时发现不一致就清空自己的缓冲区
+    std::atomic<uint32_t> generation_{0};
+    unsigned long tid_ = 0;
+};
+
+std::atomic<uint32_t> s_generation{0};
+
+struct TraceRegistry
+{
+    std::mutex mtx_;
+    std::vector<std::unique_ptr<TraceRing>> rings_;
+    std::vector<TraceRing*> free_;      // 线程退出后留下的缓冲区, 给新线程复用
+    std::size_t capacity_ = 64 * 1024;
+
+    static TraceRegistry& getInstance()
+    {
+        static TraceRegistry obj;
+        return obj;
+    }
+
+    TraceRing* Acquire()
+    {
+        std::unique_lock<std::mutex> lock(mtx_);
+        TraceRing* ring;
+        if (!free_.empty()) {
+            ring = free_.back();
+            free_.pop_back();
+        } else {
+            std::size_t cap = 1;
+            while (cap < capacity_)
+                cap <<= 1;
+            rings_.emplace_back(new TraceRing);
+            ring = rings_.back().get();
+            ring->buf_.reset(new TraceRecord[cap]);
+            ring->mask_ = cap - 1;
+        }
+        ring->head_.store(0, std::memory_order_relaxed);
+        ring->generation_.store(s_generation.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        ring->tid_ = NativeThreadID();
+        return ring;
+    }
+
+    void Release(TraceRing* ring)
+    {
+        std::unique_lock<std::mutex> lock(mtx_);
+        free_.push_back(ring);
+    }
+};
+
+LIBGO_TLS_INITIAL_EXEC TraceRing* t_traceRing = nullptr;
+
+// 线程退出时归还缓冲区(事件保留到被新线程复用为止)
+struct TraceRingHolder
+{
+    ~TraceRingHolder()
+    {
+        if (t_traceRing)
+            TraceRegistry::getInstance().Release(t_traceRing);
+        t_traceRing = nullptr;
+    }
+};
+
+TraceRing* AcquireThreadRing()
+{
+    static thread_local TraceRingHolder holder;
+    (void)holder;
+    t_traceRing = TraceRegistry::getInstance().Acquire();
+    return t_traceRing;
+}
+
+} // namespace
+
+void Tracer::Start(std::size_t eventsPerThread)
+{
+    TraceRegistry & reg = TraceRegistry::getInstance();
+    {
+        std::unique_lock<std::mutex> lock(reg.mtx_);
+        reg.capacity_ = eventsPerThread ? eventsPerThread : 1;
+    }
+    s_generation.fetch_add(1, std::memory_order_relaxed);
+    enabled_.store(true, std::memory_order_release);
+}
+
+void Tracer::Stop()
+{
+    enabled_.store(false, std::memory_order_release);
+}
+
+void Tracer::Record(eTraceEvent type, uint64_t taskId, uint64_t arg, uint32_t arg2)
+{
+    TraceRing* ring = t_traceRing;
+    if (UNLIKELY(!ring))
+        ring = AcquireThreadRing();
+
+    uint32_t gen = s_generation.load(std::memory_order_relaxed);
+    if (UNLIKELY(ring->generation_.load(std::memory_order_relaxed) != gen)) {
+        ring->head_.store(0, std::memory_order_relaxed);
+        ring->generation_.store(gen, std::memory_order_relaxed);
+    }
+
+    uint64_t head = ring->head_.load(std::memory_order_relaxed);
+    TraceRecord & rec = ring->buf_[head & ring->mask_];
+    rec.ticks_ = FastSteadyClock::ticks();
+    rec.taskId_ = taskId;
+    rec.arg_ = arg;
+    rec.arg2_ = arg2;
+    rec.type_ = type;
+    ring->head_.store(head + 1, std::memory_order_release);
+}
+
+std::string Tracer::DumpChromeJson()
+{
+    TraceRegistry & reg = TraceRegistry::getInstance();
+    std::unique_lock<std::mutex> lock(reg.mtx_);
+    uint32_t gen = s_generation.load(std::memory_order_relaxed);
+
+    // 每个缓冲区中有效的事件区间[begin, end)
+    struct Range { TraceRing* ring; uint64_t begin; uint64_t end; };
+    std::vector<Range> ranges;
+    uint64_t base = (std::numeric_limits<uint64_t>::max)();
+    for (auto & ring : reg.rings_) {
+        if (ring->generation_.load(std::memory_order_relaxed) != gen)
+            continue;
+        uint64_t end = ring->head_.load(std::memory_order_acquire);
+        uint64_t size = ring->mask_ + 1;
+        uint64_t begin = end > size ? end - size : 0;
+        if (begin == end)
+            continue;
+        ranges.push_back(Range{ring.get(), begin, end});
+        base = (std::min)(base, ring->buf_[begin & ring->mask_].ticks_);
+    }
+
+    auto us = [&](uint64_t ticks) {
+        return ticks > base ? FastSteadyClock::ticks_to_ns(ticks - base) / 1000.0 : 0.0;
+    };
+
+    std::string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    char buf[256];
+    bool first = true;
+    auto append = [&](int len) {
+        if (!first) out += ',';
+        out.append(buf, len);
+        first = false;
+    };
+
+    for (Range & r : ranges) {
+        TraceRing* ring = r.ring;
+        append(snprintf(buf, sizeof(buf),
+                    "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%lu,\"args\":{\"name\":\"libgo thread %lu\"}}",
+                    ring->tid_, ring->tid_));
+
+        // 切入/切出配对成一个时长事件, 配不上的(被覆盖了一半)丢弃
+        TraceRecord const* swapIn = nullptr;
+        for (uint64_t i = r.begin; i < r.end; ++i) {
+            TraceRecord const& rec = ring->buf_[i & ring->mask_];
+            if (rec.type_ == eTraceEvent::swapIn) {
+                swapIn = &rec;
+                continue;
+            }
+
+            if (rec.type_ == eTraceEvent::swapOut) {
+                if (swapIn && swapIn->taskId_ == rec.taskId_)
+                    append(snprintf(buf, sizeof(buf),
+                                "{\"name\":\"task %llu\",\"ph\":\"X\",\"pid\":1,\"tid\":%lu,\"ts\":%.3f,\"dur\":%.3f,"
+                                "\"args\":{\"proc\":%u,\"state\":\"%s\"}}",
+                                (unsigned long long)rec.taskId_, ring->tid_, us(swapIn->ticks_),
+                                us(rec.ticks_) - us(swapIn->ticks_), swapIn->arg2_,
+                                GetTaskStateName((TaskState)rec.arg_)));
+                swapIn = nullptr;
+                continue;
+            }
+
+            append(snprintf(buf, sizeof(buf),
+                        "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%lu,\"ts\":%.3f,"
+                        "\"args\":{\"task\":%llu,\"arg\":%llu,\"arg2\":%u}}",
+                        GetTraceEventName(rec.type_), ring->tid_, us(rec.ticks_),
+                        (unsigned long long)rec.taskId_, (unsigned long long)rec.arg_, rec.arg2_));
+        }
+    }
+    out += "]}";
+    return out;
+}
+
+bool Tracer::DumpChromeJson(const char* path)
+{
+    std::string json = DumpChromeJson();
+    FILE* fp = fopen(path, "w");
+    if (!fp) return false;
+    bool ok = fwrite(json.data(), 1, json.size(), fp) == json.size();
+    ok = (fclose(fp) == 0) && ok;
+    return ok;
+}
+
+} // namespace co
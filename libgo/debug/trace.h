@@ -0,0 +1,71 @@
+#pragma once
+#include "../common/config.h"
+#include <atomic>
+#include <string>
+
+namespace co
+{
+
+// 调度事件类型
+enum class eTraceEvent : uint8_t
+{
+    create,     // 创建协程. arg: 创建者协程ID(不在协程中为0)
+    swapIn,     // 切入协程. arg2: P的ID
+    swapOut,    // 切出协程. arg: 切出后的状态(TaskState)
+    suspend,    // 协程挂起
+    wakeup,     // 唤醒协程. arg: 唤醒者协程ID(不在协程中为0), arg2: 放入的P的ID
+    steal,      // 负载均衡偷走协程. arg: 数量, arg2: 被偷的P的ID
+    reactor,    // IO事件触发. arg: fd, arg2: poll事件
+    timer,      // 挂起超时的定时器触发
+};
+
+const char* GetTraceEventName(eTraceEvent type);
+
+// 定长的二进制事件记录
+struct TraceRecord
+{
+    uint64_t ticks_;        // FastSteadyClock::ticks
+    uint64_t taskId_;       // 相关的协程ID, 没有时为0
+    uint64_t arg_;
+    uint32_t arg2_;
+    eTraceEvent type_;
+};
+
+// 调度事件追踪
+// 始终编译, 运行时开关. 每个线程写自己的环形缓冲区(单写者, 无锁), 写满后覆盖最旧的事件,
+// 记录一个事件只有一次tsc读取和几次内存写入. 关闭时只有一次原子变量的读取.
+// 导出为Chrome trace JSON格式, 可以用chrome://tracing或Perfetto(ui.perfetto.dev)打开.
+class Tracer
+{
+public:
+    // 开始记录, 清空之前的记录.
+    // @eventsPerThread: 每个线程的缓冲区大小(事件数), 向上取整到2的幂.
+    //                   只在线程第一次记录事件时生效, 之后再次Start不会改变已有缓冲区的大小.
+    static void Start(std::size_t eventsPerThread = 64 * 1024);
+
+    // 停止记录, 已记录的事件保留到下次Start
+    static void Stop();
+
+    ALWAYS_INLINE static bool IsEnabled()
+    {
+        return enabled_.load(std::memory_order_relaxed);
+    }
+
+    static void Record(eTraceEvent type, uint64_t taskId, uint64_t arg = 0, uint32_t arg2 = 0);
+
+    // 导出Chrome trace JSON. 导出前应当先Stop, 否则正在写入的事件可能不完整.
+    static std::string DumpChromeJson();
+    static bool DumpChromeJson(const char* path);
+
+private:
+    static std::atomic<bool> enabled_;
+};
+
+// 记录一个调度事件, 未开启时只判断一次开关
+#define TracePoint(...) \
+    do { \
+        if (UNLIKELY(::co::Tracer::IsEnabled())) \
+            ::co::Tracer::Record(__VA_ARGS__); \
+    } while (0)
+
+} // namespace co
@@ -86,7 +86,8 @@ void EpollReactor::Run()
 {
     const int cEvent = 1024;
     struct epoll_event evs[cEvent];
-    int n = CallWithoutINTR<int>(::epoll_wait, epfd_, evs, cEvent, 10);
+    // 没有事件时一直阻塞, 不做周期性唤醒
+    int n = CallWithoutINTR<int>(::epoll_wait, epfd_, evs, cEvent, -1);
     for (int i = 0; i < n; ++i) {
         struct epoll_event & ev = evs[i];
         int fd = ev.data.fd;
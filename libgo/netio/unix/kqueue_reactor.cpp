@@ -75,10 +75,8 @@ void KqueueReactor::Run()
 {
     const int cEvent = 1024;
     struct kevent kev[cEvent];
-    struct timespec timeout;
-    timeout.tv_sec = 0;
-    timeout.tv_nsec = 10 * 1000 * 1000;
-    int n = kevent(kq_, nullptr, 0, kev, cEvent, &timeout);
+    // 没有事件时一直阻塞, 不做周期性唤醒
+    int n = kevent(kq_, nullptr, 0, kev, cEvent, nullptr);
     std::unordered_map<int, short int> eventMap;
     for (int i = 0; i < n; ++i) {
         struct kevent & ev = kev[i];
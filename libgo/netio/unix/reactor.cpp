@@ -5,6 +5,7 @@
 #include <thread>
 #include "epoll_reactor.h"
 #include "kqueue_reactor.h"
+#include "../../common/cpu_affinity.h"
 
 namespace co {
 
@@ -44,6 +45,7 @@ void Reactor::InitLoopThread()
 {
     std::thread thr([this]{
                 DebugPrint(dbg_thread, "Start reactor(epoll/kqueue) thread id: %lu", NativeThreadID());
+                BindCurrentThreadToCpus(CoroutineOptions::getInstance().reactor_cpus);
                 for (;;) this->Run();
             });
     thr.detach();
@@ -3,6 +3,7 @@
 #include <algorithm>
 #include "fd_context.h"
 #include "reactor.h"
+#include "../../debug/trace.h"
 
 namespace co {
 
@@ -59,6 +60,7 @@ void ReactorElement::Trigger(Reactor * reactor, short int pollEvent)
     short int promiseEvent = 0;
 
     DebugPrint(dbg_ioblock, "Trigger fd = %d, pollEvent = %s", fd_, PollEvent2Str(pollEvent));
+    TracePoint(eTraceEvent::reactor, 0, fd_, (uint16_t)pollEvent);
 
     short int check = POLLIN | errEvent;
     if (pollEvent & check) {
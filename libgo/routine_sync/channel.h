@@ -1,6 +1,7 @@
 #pragma once
 #include "condition_variable.h"
 #include "timer.h"
+#include "ring_queue.h"
 #include <deque>
 #include <exception>
 #include <iomanip>
@@ -58,10 +59,13 @@ public:
         }
 
         // 开始等待
-        T temp;
-        ConditionVariable waiting;
+        // 共享栈的routine休眠时栈会被复用, 对端要访问的对象放到堆上
+        bool onHeap = RoutineSyncPolicy::isStackShared();
+        WaitingObject<T> temp(onHeap);
+        WaitingObject<ConditionVariable> waitingHolder(onHeap);
+        ConditionVariable & waiting = *waitingHolder;
 
-        popQ_ = &temp;
+        popQ_ = temp.get();
         popWaiting_ = &waiting;
 
         RS_DBG(dbg_channel, "channel=%ld | %s | begin wait matched",
@@ -76,7 +80,7 @@ public:
 
         if (ok) {
             // 成功
-            t = std::move(temp);    // 对外部T的写操作放到本线程来做, 降低使用难度
+            t = std::move(*temp);    // 对外部T的写操作放到本线程来做, 降低使用难度
         } else if (!changed) {
             // 超时，清理
             popQ_ = nullptr;
@@ -162,9 +166,13 @@ public:
         }
 
         // 开始等待
-        ConditionVariable waiting;
+        // 共享栈的routine休眠时栈会被复用, 对端要访问的对象放到堆上
+        bool onHeap = RoutineSyncPolicy::isStackShared();
+        std::unique_ptr<T> copy(onHeap ? new T(t) : nullptr);
+        WaitingObject<ConditionVariable> waitingHolder(onHeap);
+        ConditionVariable & waiting = *waitingHolder;
 
-        pushQ_ = &t;
+        pushQ_ = onHeap ? copy.get() : &t;
         pushWaiting_ = &waiting;
 
         RS_DBG(dbg_channel, "channel=%ld | %s | begin wait matched",
@@ -289,9 +297,24 @@ public:
     using ChannelImplWithSignal<T>::id;
     using ChannelImplWithSignal<T>::impl_with_signal_close;
 
+    // 使用默认队列的有缓冲channel换成预分配槽位的无锁环形队列,
+    // 只有满/空需要等待时才进入Rutex的等待队列.
+    // 以下情况仍然使用加锁的队列:
+    //   1.自定义QueueT
+    //   2.T的拷贝构造或移动赋值可能抛出异常: 环形队列抢到槽位后无法归还, 异常会使队列不可用
+    //   3.槽位总大小超过kMaxRingBytes: 环形队列按容量一次分配好, 大容量的channel用deque按需增长
+    typedef std::integral_constant<bool,
+            std::is_same<QueueT, std::deque<T>>::value &&
+            std::is_nothrow_copy_constructible<T>::value &&
+            std::is_nothrow_move_assignable<T>::value> use_ring_t;
+
+    static const std::size_t kMaxRingBytes = 4 * 1024 * 1024;
+
     explicit ChannelImpl(std::size_t capacity = 0)
         : cap_(capacity)
     {
+        if (use_ring_t::value && cap_ && cap_ <= kMaxRingBytes / (sizeof(T) + sizeof(std::size_t)))
+            init_ring(use_ring_t());
     }
 
     template<typename _Clock, typename _Duration>
@@ -299,7 +322,7 @@ public:
             const std::chrono::time_point<_Clock, _Duration>* abstime)
     {
         if (cap_) {
-            return push_impl_with_cap(t, isWait, abstime);
+            return push_impl_with_cap(t, isWait, abstime, use_ring_t());
         }
 
         return push_impl_with_signal(t, isWait, abstime);
@@ -310,7 +333,7 @@ public:
             const std::chrono::time_point<_Clock, _Duration>* abstime)
     {
         if (cap_) {
-            return pop_impl_with_cap(t, isWait, abstime);
+            return pop_impl_with_cap(t, isWait, abstime, use_ring_t());
         }
 
         return pop_impl_with_signal(t, isWait, abstime);
@@ -328,8 +351,7 @@ public:
 
     std::size_t size()
     {
-        std::unique_lock<Mutex> lock(mtx_);
-        return q_.size();
+        return size_impl(use_ring_t());
     }
 
     std::size_t empty()
@@ -347,17 +369,178 @@ public:
 
         long push_wakeup = pushCv_.fast_notify_all(lock);
         long pop_wakeup = popCv_.fast_notify_all(lock);
+
+        if (ring_) {
+            ringClosed_.store(true, std::memory_order_seq_cst);
+            pushRutex_.value()->fetch_add(1, std::memory_order_release);
+            popRutex_.value()->fetch_add(1, std::memory_order_release);
+            push_wakeup += pushRutex_.notify_all();
+            pop_wakeup += popRutex_.notify_all();
+        }
+
         (void)push_wakeup;
         (void)pop_wakeup;
 
         RS_DBG(dbg_channel, "channel(queue)=%ld | %s | cap=%lu | size=%lu | push-wakeup=%ld | pop-wakeup=%ld",
-            id(), __func__, cap_, q_.size(), push_wakeup, pop_wakeup);
+            id(), __func__, cap_, size_unlocked(use_ring_t()), push_wakeup, pop_wakeup);
     }
 
 private:
+    void init_ring(std::true_type)
+    {
+        ring_.reset(new RingQueue<T>);
+        ring_->init(cap_);
+    }
+
+    void init_ring(std::false_type) {}
+
+    std::size_t size_unlocked(std::true_type)
+    {
+        return ring_ ? ring_->size() : q_.size();
+    }
+
+    std::size_t size_unlocked(std::false_type)
+    {
+        return q_.size();
+    }
+
+    std::size_t size_impl(std::true_type)
+    {
+        if (ring_)
+            return ring_->size();
+
+        std::unique_lock<Mutex> lock(mtx_);
+        return q_.size();
+    }
+
+    std::size_t size_impl(std::false_type)
+    {
+        std::unique_lock<Mutex> lock(mtx_);
+        return q_.size();
+    }
+
+    // 对端有等待者时才去唤醒.
+    // 和等待方"登记waiters之后再重试一次"配对: 要么等待方的重试能看到刚写入/腾出的槽位,
+    // 要么这里能看到等待方的登记, 不会漏掉唤醒.
+    static void ring_wakeup(Rutex<unsigned> & rutex, std::atomic<long> & waiters)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters.load(std::memory_order_relaxed) == 0)
+            return ;
+
+        rutex.value()->fetch_add(1, std::memory_order_release);
+        rutex.notify_one();
+    }
+
     template<typename _Clock, typename _Duration>
     bool push_impl_with_cap(T const& t, bool isWait,
-            const std::chrono::time_point<_Clock, _Duration>* abstime)
+            const std::chrono::time_point<_Clock, _Duration>* abstime,
+            std::true_type)
+    {
+        if (!ring_)
+            return push_impl_with_cap(t, isWait, abstime, std::false_type());
+
+        RS_DBG(dbg_channel, "channel(ring)=%ld | %s | ptr(t)=0x%p | isWait=%d | abstime=%d | closed=%d | cap=%lu | size=%lu",
+            id(), __func__, (void*)&t, isWait, !!abstime, (int)ringClosed_.load(), cap_, ring_->size());
+
+        for (;;) {
+            if (ringClosed_.load(std::memory_order_acquire))
+                return false;
+
+            if (ring_->try_push(t)) {
+                ring_wakeup(popRutex_, popWaiters_);
+                return true;
+            }
+
+            if (!isWait) {
+                RS_DBG(dbg_channel, "channel(ring)=%ld | %s | full && not wait | return false",
+                    id(), __func__);
+                return false;
+            }
+
+            // 满了, 登记之后再试一次, 仍然满才真正等待
+            unsigned seq = pushRutex_.value()->load(std::memory_order_acquire);
+            pushWaiters_.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            bool ok = !ringClosed_.load(std::memory_order_relaxed) && ring_->try_push(t);
+            Rutex<unsigned>::rutex_wait_return res = Rutex<unsigned>::rutex_wait_return_success;
+            if (!ok && !ringClosed_.load(std::memory_order_relaxed)) {
+                RS_DBG(dbg_channel, "channel(ring)=%ld | %s | begin wait", id(), __func__);
+                res = pushRutex_.wait_until(seq, abstime);
+            }
+
+            pushWaiters_.fetch_sub(1, std::memory_order_relaxed);
+
+            if (ok) {
+                ring_wakeup(popRutex_, popWaiters_);
+                return true;
+            }
+
+            if (res == Rutex<unsigned>::rutex_wait_return_etimeout) {
+                RS_DBG(dbg_channel, "channel(ring)=%ld | %s | waked | timeout", id(), __func__);
+                isWait = false;     // 超时前可能刚好有空位, 最后再试一次
+            }
+        }
+    }
+
+    template<typename _Clock, typename _Duration>
+    bool pop_impl_with_cap(T & t, bool isWait,
+            const std::chrono::time_point<_Clock, _Duration>* abstime,
+            std::true_type)
+    {
+        if (!ring_)
+            return pop_impl_with_cap(t, isWait, abstime, std::false_type());
+
+        RS_DBG(dbg_channel, "channel(ring)=%ld | %s | ptr(t)=0x%p | isWait=%d | abstime=%d | closed=%d | cap=%lu | size=%lu",
+            id(), __func__, (void*)&t, isWait, !!abstime, (int)ringClosed_.load(), cap_, ring_->size());
+
+        for (;;) {
+            // 关闭后仍然可以读出剩余的数据
+            if (ring_->try_pop(t)) {
+                ring_wakeup(pushRutex_, pushWaiters_);
+                return true;
+            }
+
+            if (ringClosed_.load(std::memory_order_acquire))
+                return false;
+
+            if (!isWait) {
+                RS_DBG(dbg_channel, "channel(ring)=%ld | %s | empty && not wait | return false",
+                    id(), __func__);
+                return false;
+            }
+
+            // 空了, 登记之后再试一次, 仍然空才真正等待
+            unsigned seq = popRutex_.value()->load(std::memory_order_acquire);
+            popWaiters_.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            bool ok = ring_->try_pop(t);
+            Rutex<unsigned>::rutex_wait_return res = Rutex<unsigned>::rutex_wait_return_success;
+            if (!ok && !ringClosed_.load(std::memory_order_relaxed)) {
+                RS_DBG(dbg_channel, "channel(ring)=%ld | %s | begin wait", id(), __func__);
+                res = popRutex_.wait_until(seq, abstime);
+            }
+
+            popWaiters_.fetch_sub(1, std::memory_order_relaxed);
+
+            if (ok) {
+                ring_wakeup(pushRutex_, pushWaiters_);
+                return true;
+            }
+
+            if (res == Rutex<unsigned>::rutex_wait_return_etimeout) {
+                RS_DBG(dbg_channel, "channel(ring)=%ld | %s | waked | timeout", id(), __func__);
+                isWait = false;     // 超时前可能刚好有数据, 最后再试一次
+            }
+        }
+    }
+
+    template<typename _Clock, typename _Duration>
+    bool push_impl_with_cap(T const& t, bool isWait,
+            const std::chrono::time_point<_Clock, _Duration>* abstime,
+            std::false_type)
     {
         std::unique_lock<Mutex> lock(mtx_);
 
@@ -411,7 +594,8 @@ private:
 
     template<typename _Clock, typename _Duration>
     bool pop_impl_with_cap(T & t, bool isWait,
-            const std::chrono::time_point<_Clock, _Duration>* abstime)
+            const std::chrono::time_point<_Clock, _Duration>* abstime,
+            std::false_type)
     {
         std::unique_lock<Mutex> lock(mtx_);
 
@@ -468,6 +652,14 @@ private:
 private:
     QueueT q_;
     std::size_t cap_;
+
+    // 以下只在无锁环形队列中使用, 不使用环形队列时ring_为空
+    std::unique_ptr<RingQueue<T>> ring_;
+    std::atomic<bool> ringClosed_ {false};
+    std::atomic<long> pushWaiters_ {0};
+    std::atomic<long> popWaiters_ {0};
+    Rutex<unsigned> pushRutex_;
+    Rutex<unsigned> popRutex_;
 };
 
 // 仅计数
@@ -0,0 +1,160 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <new>
+#include <utility>
+#include <stdint.h>
+#include <stdlib.h>
+#include <type_traits>
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+
+namespace libgo
+{
+
+// 有界的多生产者多消费者无锁环形队列 (Dmitry Vyukov的bounded MPMC queue)
+//
+// 每个槽位带一个序号, 生产者和消费者各持有一个递增的票号(ticket), CAS抢到票号后独占对应的槽位:
+//   序号 == 票号*2       空槽, 生产者可以写入, 写完后序号置为票号*2+1
+//   序号 == 票号*2 + 1   有数据, 消费者可以读出, 读完后序号推进一圈((票号+容量)*2)留给下一轮的生产者
+// 序号用票号的2倍, 这样容量为1时"有数据"和"下一轮的空槽"也不会混淆.
+// 生产者和消费者只在同一个槽位上有交互, 队列不满不空时互不干扰.
+//
+// 槽位在init时一次分配好, 之后的push/pop不再分配内存.
+// 容量不要求是2的幂, 满/空时try_push/try_pop直接返回false, 不阻塞.
+// T的构造函数抛出异常时, 已抢到的槽位无法归还, 队列将不可用. 因此T的拷贝构造和移动赋值不能抛出异常,
+// channel只在二者都是noexcept时才使用这个队列.
+//
+// 生产者和消费者的票号各占一个cache line, 对象需要按64字节对齐分配, 因此只能通过new创建.
+template <typename T>
+class RingQueue
+{
+public:
+    RingQueue() = default;
+    RingQueue(RingQueue const&) = delete;
+    RingQueue& operator=(RingQueue const&) = delete;
+
+    // C++11的operator new不保证超过16字节的对齐
+    static void* operator new(std::size_t size)
+    {
+        void* p = nullptr;
+#if defined(_WIN32)
+        p = _aligned_malloc(size, alignof(RingQueue));
+#else
+        if (posix_memalign(&p, alignof(RingQueue), size) != 0)
+            p = nullptr;
+#endif
+        if (!p) throw std::bad_alloc();
+        return p;
+    }
+
+    static void operator delete(void* ptr)
+    {
+#if defined(_WIN32)
+        _aligned_free(ptr);
+#else
+        free(ptr);
+#endif
+    }
+
+    ~RingQueue()
+    {
+        if (!cells_) return ;
+
+        std::size_t tail = enqueuePos_.load(std::memory_order_relaxed);
+        for (std::size_t pos = dequeuePos_.load(std::memory_order_relaxed); pos != tail; ++pos)
+            cells_[pos % cap_].data()->~T();
+    }
+
+    // 只能在使用前调用一次
+    void init(std::size_t capacity)
+    {
+        cap_ = capacity;
+        cells_.reset(new Cell[capacity]);
+        for (std::size_t i = 0; i < capacity; ++i)
+            cells_[i].seq_.store(i * 2, std::memory_order_relaxed);
+    }
+
+    std::size_t capacity() const { return cap_; }
+
+    template <typename U>
+    bool try_push(U && u)
+    {
+        Cell* cell;
+        std::size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+        for (;;) {
+            cell = &cells_[pos % cap_];
+            std::size_t seq = cell->seq_.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos * 2);
+            if (diff == 0) {
+                if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                // 上一轮的数据还没被读走: 满
+                return false;
+            } else {
+                pos = enqueuePos_.load(std::memory_order_relaxed);
+            }
+        }
+
+        new (cell->data()) T(std::forward<U>(u));
+        cell->seq_.store(pos * 2 + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool try_pop(T & t)
+    {
+        Cell* cell;
+        std::size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+        for (;;) {
+            cell = &cells_[pos % cap_];
+            std::size_t seq = cell->seq_.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos * 2 + 1);
+            if (diff == 0) {
+                if (dequeuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                // 这一轮的数据还没写入: 空
+                return false;
+            } else {
+                pos = dequeuePos_.load(std::memory_order_relaxed);
+            }
+        }
+
+        T* p = cell->data();
+        t = std::move(*p);
+        p->~T();
+        cell->seq_.store((pos + cap_) * 2, std::memory_order_release);
+        return true;
+    }
+
+    // 近似值, 并发push/pop时只保证在[0, capacity]之内
+    std::size_t size() const
+    {
+        std::size_t head = dequeuePos_.load(std::memory_order_relaxed);
+        std::size_t tail = enqueuePos_.load(std::memory_order_relaxed);
+        if (tail <= head) return 0;
+        return (tail - head) < cap_ ? (tail - head) : cap_;
+    }
+
+    bool empty() const { return size() == 0; }
+
+private:
+    struct Cell
+    {
+        std::atomic<std::size_t> seq_;
+        typename std::aligned_storage<sizeof(T), std::alignment_of<T>::value>::type storage_;
+
+        T* data() { return reinterpret_cast<T*>(&storage_); }
+    };
+
+    std::unique_ptr<Cell[]> cells_;
+    std::size_t cap_ {0};
+
+    // 生产者和消费者的票号放到不同的cache line上, 避免伪共享
+    alignas(64) std::atomic<std::size_t> enqueuePos_ {0};
+    alignas(64) std::atomic<std::size_t> dequeuePos_ {0};
+};
+
+} //namespace libgo
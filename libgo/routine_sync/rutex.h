@@ -224,7 +224,9 @@ public:
             }
         }
 
-        RutexWaiter rw(*switcher);
+        // 共享栈的routine休眠时栈会被复用, 等待节点放到堆上
+        WaitingObject<RutexWaiter> rwHolder(switcher->stackShared(), *switcher);
+        RutexWaiter & rw = *rwHolder;
 
         {
             std::unique_lock<std::mutex> lock(mtx_);
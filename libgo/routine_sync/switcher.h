@@ -1,5 +1,7 @@
 #pragma once
 #include <memory>
+#include <new>
+#include <type_traits>
 #include <functional>
 #include <condition_variable>
 #include <mutex>
@@ -42,6 +44,10 @@ public:
     // @要求: 一次sleep多次wake，只有其中一次wake成功，并且其他wake不会产生副作用
     virtual bool wake() = 0;
 
+    // routine休眠期间, 它的栈内存是否会被其他routine使用(共享栈).
+    // 返回true时, 休眠期间需要被其他routine访问的对象(等待节点等)不能放在栈上.
+    virtual bool stackShared() const { return false; }
+
     // 判断是否在协程中 (子类switcher必须实现这个接口)
     //static bool isInRoutine();
 
@@ -134,6 +140,12 @@ public:
         return isInPThreadFunction()();
     }
 
+    // 当前routine是否运行在共享栈上
+    static bool isStackShared()
+    {
+        return !isInPThread() && clsRef().stackShared();
+    }
+
 private:
     typedef std::function<RoutineSwitcherI& ()> ClsRefFunction;
     typedef std::function<bool()> IsInPThreadFunction;
@@ -190,4 +202,39 @@ private:
     }
 };
 
+// 休眠期间会被其他routine访问的对象:
+// 一般直接构造在栈上, 当前routine运行在共享栈上时改为在堆上构造.
+template <typename T>
+struct WaitingObject
+{
+public:
+    template <typename ... Args>
+    explicit WaitingObject(bool onHeap, Args && ... args)
+    {
+        if (onHeap)
+            ptr_ = new T(std::forward<Args>(args)...);
+        else
+            ptr_ = new (&storage_) T(std::forward<Args>(args)...);
+    }
+
+    ~WaitingObject()
+    {
+        if ((void*)ptr_ == (void*)&storage_)
+            ptr_->~T();
+        else
+            delete ptr_;
+    }
+
+    T& operator*() { return *ptr_; }
+    T* operator->() { return ptr_; }
+    T* get() { return ptr_; }
+
+    WaitingObject(WaitingObject const&) = delete;
+    WaitingObject& operator=(WaitingObject const&) = delete;
+
+private:
+    T* ptr_;
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage_;
+};
+
 } // namespace libgo
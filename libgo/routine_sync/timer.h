@@ -3,6 +3,7 @@
 #include <mutex>
 #include <memory>
 #include <functional>
+#include <limits>
 #include <condition_variable>
 #include "linked_skiplist.h"
 
@@ -90,8 +91,9 @@ public:
 
     inline static clock_type::time_point now() { return clock_type::now(); }
 
+    // 没有定时任务时的最长休眠时间, 为0时一直休眠到有新的定时任务加入
     inline static std::chrono::milliseconds& loop_interval() {
-        static std::chrono::milliseconds interval(20);
+        static std::chrono::milliseconds interval(0);
         return interval;
     }
 
@@ -160,18 +162,21 @@ public:
                 continue;
             }
 
-            std::chrono::milliseconds sleepTime(1);
+            // 直接休眠到最近的定时任务到期, 更早的任务插入时会被唤醒
+            clock_type::time_point wakeTp;
             if (id) {
-                std::chrono::milliseconds delta = std::chrono::duration_cast<
-                    std::chrono::milliseconds>(id->key - nowTp);
-                sleepTime = (std::min)(sleepTime, delta);
+                wakeTp = id->key;
+            } else if (loop_interval().count()) {
+                wakeTp = nowTp + loop_interval();
             } else {
-                sleepTime = loop_interval();
+                nextCheckAbstime_ = (std::numeric_limits<int64_t>::max)();
+                cv_.wait(lock);
+                continue;
             }
 
-            nextCheckAbstime_ = std::chrono::duration_cast<std::chrono::nanoseconds>((now() + sleepTime).time_since_epoch()).count();
+            nextCheckAbstime_ = std::chrono::duration_cast<std::chrono::nanoseconds>(wakeTp.time_since_epoch()).count();
 
-            cv_.wait_for(lock, sleepTime);
+            cv_.wait_until(lock, wakeTp);
         }
     }
 
@@ -237,6 +242,8 @@ public:
             thread_.join();
     }
 
+    std::thread & thread() { return thread_; }
+
 private:
     std::thread thread_;
 };
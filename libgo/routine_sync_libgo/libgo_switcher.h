@@ -10,6 +10,8 @@ namespace co
 struct LibgoSwitcher : public libgo::RoutineSwitcherI
 {
 public:
+    explicit LibgoSwitcher(bool stackShared = false) : stackShared_(stackShared) {}
+
     // 把当前routine标记为休眠状态, 但不立即休眠routine
     // 如下两种执行顺序都必须支持:
     //  mark -> sleep -> wake
@@ -30,6 +32,11 @@ public:
         return Processer::Wakeup(entry_);
     }
 
+    // 共享栈模式的协程休眠期间, 栈内存会被同一个P上的其他协程使用
+    virtual bool stackShared() const override {
+        return stackShared_;
+    }
+
     // 判断是否在协程中 (子类switcher必须实现这个接口)
     static bool isInRoutine() {
         return Processer::IsCoroutine();
@@ -43,6 +50,7 @@ public:
 
 private:
     Processer::SuspendEntry entry_;
+    bool stackShared_;
 };
 
 } // namespace co
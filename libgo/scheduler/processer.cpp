@@ -2,23 +2,31 @@
 #include "scheduler.h"
 #include "../common/error.h"
 #include "../common/clock.h"
+#include "../common/cpu_affinity.h"
 #include <assert.h>
+#include <limits>
 #include "ref.h"
+#include "../debug/trace.h"
+
+extern "C" {
+    LIBGO_TLS_INITIAL_EXEC co::TlsBlock libgo_tls_block = {};
+}
 
 namespace co {
 
 int Processer::s_check_ = 0;
 
 Processer::Processer(Scheduler * scheduler, int id)
-    : scheduler_(scheduler), id_(id)
-{
-    waitQueue_.setLock(&runnableQueue_.LockRef());
-}
-
-Processer* & Processer::GetCurrentProcesser()
+    : scheduler_(scheduler), id_(id),
+    sharedStack_(CoroutineOptions::getInstance().shared_stack_size)
 {
-    static thread_local Processer *proc = nullptr;
-    return proc;
+    deadlineQueue_.setLock(&runnableLock_);
+    levels_[0] = &deadlineQueue_;
+    for (int i = 0; i < prio_count; ++i) {
+        runnableQueues_[i].setLock(&runnableLock_);
+        levels_[i + 1] = &runnableQueues_[i];
+    }
+    waitQueue_.setLock(&runnableLock_);
 }
 
 Scheduler* Processer::GetCurrentScheduler()
@@ -30,43 +38,158 @@ Scheduler* Processer::GetCurrentScheduler()
 void Processer::AddTask(Task *tk)
 {
     DebugPrint(dbg_task | dbg_scheduler, "task(%s) add into proc(%u)(%p)", tk->DebugInfo(), id_, (void*)this);
-    std::unique_lock<TaskQueue::lock_t> lock(newQueue_.LockRef());
-    newQueue_.pushWithoutLock(tk);
-    newQueue_.AssertLink();
-    if (waiting_)
-        cv_.notify_all();
-    else
-        notified_ = true;
+    {
+        std::unique_lock<TaskQueue::lock_t> lock(newQueue_.LockRef());
+        newQueue_.pushWithoutLock(tk);
+        newQueue_.AssertLink();
+    }
+    parker_.Unpark();
+    ReviveIfDormant();
 }
 
 void Processer::AddTask(SList<Task> && slist)
 {
     DebugPrint(dbg_scheduler, "task(num=%d) add into proc(%u)", (int)slist.size(), id_);
-    std::unique_lock<TaskQueue::lock_t> lock(newQueue_.LockRef());
-    newQueue_.pushWithoutLock(std::move(slist));
-    newQueue_.AssertLink();
-    if (waiting_)
-        cv_.notify_all();
-    else
-        notified_ = true;
+    {
+        std::unique_lock<TaskQueue::lock_t> lock(newQueue_.LockRef());
+        newQueue_.pushWithoutLock(std::move(slist));
+        newQueue_.AssertLink();
+    }
+    parker_.Unpark();
+    ReviveIfDormant();
 }
 
-void Processer::NotifyCondition()
+void Processer::AddStolenTasks(SList<Task> && slist)
 {
-    std::unique_lock<TaskQueue::lock_t> lock(newQueue_.LockRef());
-    if (waiting_) {
-        DebugPrint(dbg_scheduler, "NotifyCondition for condition. [Proc(%d)] --------------------------", id_);
-        cv_.notify_all();
+    if (CoroutineOptions::getInstance().enable_coro_stat)
+        stats_.stealIn_ += slist.size();
+    AddTask(std::move(slist));
+}
+
+void Processer::AddLightTask(TaskF && fn)
+{
+    {
+        std::unique_lock<LFLock> lock(lightLock_);
+        lightQueue_.push_back(std::move(fn));
+        if (lightRunner_)
+            return ;
+        lightRunner_ = (Task*)kLightRunnerCreating;
     }
-    else {
-        DebugPrint(dbg_scheduler, "NotifyCondition for flag. [Proc(%d)] --------------------------", id_);
-        notified_ = true;
+    StartLightRunner();
+}
+
+void Processer::StartLightRunner()
+{
+    // 分配协程和栈较慢, 放在锁外; 先发布lightRunner_再加入队列, 执行协程开始运行时才能认出自己
+    Task* tk = scheduler_->CreateLightRunner(this);
+    {
+        std::unique_lock<LFLock> lock(lightLock_);
+        lightRunner_ = tk;
     }
+    AddTask(tk);
+}
+
+void Processer::RunLightTasks()
+{
+    Task* self = GetCurrentTask();
+    for (;;) {
+        TaskF fn;
+        {
+            std::unique_lock<LFLock> lock(lightLock_);
+            if (lightRunner_ != self)
+                return ;    // 已经升级为普通协程
+
+            if (lightQueue_.empty()) {
+                lightRunner_ = nullptr;
+                return ;
+            }
+
+            fn.swap(lightQueue_.front());
+            lightQueue_.pop_front();
+        }
+
+        try {
+            fn();
+        } catch (...) {
+            ReleaseLightRunner(self);
+            throw;
+        }
+    }
+}
+
+void Processer::ReleaseLightRunner(Task* tk)
+{
+    {
+        std::unique_lock<LFLock> lock(lightLock_);
+        if (lightRunner_ != tk)
+            return ;
+
+        DebugPrint(dbg_scheduler, "light runner task(%s) blocked, promote to coroutine.", tk->DebugInfo());
+        if (lightQueue_.empty()) {
+            lightRunner_ = nullptr;
+            return ;
+        }
+        lightRunner_ = (Task*)kLightRunnerCreating;
+    }
+    StartLightRunner();
+}
+
+void Processer::ReviveIfDormant()
+{
+    if (LIKELY(!dormant_)) return ;
+    if (!dormant_.exchange(false)) return ;
+
+    DebugPrint(dbg_scheduler, "Revive dormant Proc(%d) by AddTask", id_);
+    active_ = true;
+    scheduler_->StartProcessThread(this);
+    scheduler_->NotifyDispatcher();
+}
+
+bool Processer::TryRetire()
+{
+    retiring_ = false;
+    GC();
+
+    std::unique_lock<TaskQueue::lock_t> lock(newQueue_.LockRef());
+    std::unique_lock<TaskQueue::lock_t> lock2(runnableLock_);
+    if (!newQueue_.emptyUnsafe() || RunnableSizeWithoutLock() || !waitQueue_.emptyUnsafe())
+        return false;
+
+    // 在锁内切换状态, 之后的AddTask一定能看到dormant_并重新启动线程
+    active_ = false;
+    parker_.Reset();
+    dormant_ = true;
+    DebugPrint(dbg_scheduler, "Proc(%d) retired --------------------------", id_);
+    return true;
+}
+
+void Processer::NotifyCondition()
+{
+    DebugPrint(dbg_scheduler, "NotifyCondition. [Proc(%d)] --------------------------", id_);
+    parker_.Unpark();
+}
+
+void Processer::BindCpu()
+{
+    std::vector<int> const& cpus = CoroutineOptions::getInstance().processer_cpus;
+    if (cpus.empty()) return ;
+
+    int cpu = cpus[id_ % cpus.size()];
+    if (!BindCurrentThreadToCpus(std::vector<int>{cpu})) return ;
+
+    cpu_ = cpu;
+    numaNode_ = GetNumaNodeOfCpu(cpu);
+    DebugPrint(dbg_scheduler, "Proc(%d) bind to cpu(%d) numa node(%d)", id_, cpu_, numaNode_);
 }
 
 void Processer::Process()
 {
-    GetCurrentProcesser() = this;
+    TlsBlock & tb = GetTlsBlock();
+    tb.proc_ = this;
+    BindCpu();
+
+    // 上一个协程切出时的tsc计数, 空闲等待后清零
+    uint64_t lastTicks = 0;
 
 #if defined(LIBGO_SYS_Windows)
     FiberScopedGuard sg;
@@ -74,114 +197,132 @@ void Processer::Process()
 
     while (!scheduler_->IsStop())
     {
-        runnableQueue_.front(runningTask_);
+        if (UNLIKELY(retiring_) && TryRetire())
+            return ;
 
-        if (!runningTask_) {
-            if (AddNewTasks())
-                runnableQueue_.front(runningTask_);
+        // 每次切换前都收一次新协程, 保证新加入的高优先级协程能尽快被调度
+        if (!newQueue_.emptyUnsafe())
+            AddNewTasks();
 
-            if (!runningTask_) {
-                WaitCondition();
-                AddNewTasks();
-                continue;
-            }
+        {
+            std::unique_lock<TaskQueue::lock_t> lock(runnableLock_);
+            runningTask_ = PickRunnableWithoutLock();
+        }
+        tb.task_ = runningTask_;
+
+        if (!runningTask_) {
+            WaitCondition();
+            lastTicks = 0;
+            continue;
         }
 
 #if ENABLE_DEBUGGER
         DebugPrint(dbg_scheduler, "Run [Proc(%d) QueueSize:%lu] --------------------------", id_, RunnableSize());
 #endif
 
-        addNewQuota_ = 1;
-        while (runningTask_ && !scheduler_->IsStop()) {
-            runningTask_->state_ = TaskState::runnable;
-            runningTask_->proc_ = this;
+        runningTask_->state_ = TaskState::runnable;
+        runningTask_->proc_ = this;
 
 #if ENABLE_DEBUGGER
-            DebugPrint(dbg_switch, "enter task(%s)", runningTask_->DebugInfo());
-            if (Listener::GetTaskListener())
-                Listener::GetTaskListener()->onSwapIn(runningTask_->id_);
+        DebugPrint(dbg_switch, "enter task(%s)", runningTask_->DebugInfo());
+        if (Listener::GetTaskListener())
+            Listener::GetTaskListener()->onSwapIn(runningTask_->id_);
 #endif
 
-            ++switchCount_;
-
-            runningTask_->SwapIn();
+        ++switchCount_;
+
+        // cpu时间统计: 连续调度时每次切换只读一次tsc, 上一个协程切出的时刻就是这个协程的开始时刻
+        // (两次切换之间的调度开销计入下一个协程). 换算成纳秒的工作留给调度线程.
+        const bool cpuAccounting = CoroutineOptions::getInstance().load_balance_by_cpu_time;
+        const bool coroStat = CoroutineOptions::getInstance().enable_coro_stat;
+        if (UNLIKELY(coroStat)) {
+            // 开启统计时每次都重新读取, 排队时长和时间片长度都不包含调度开销
+            lastTicks = FastSteadyClock::ticks();
+            uint64_t & runnableTick = TaskRefRunnableTick(runningTask_);
+            if (runnableTick) {
+                stats_.runQueueLatency_.Add(lastTicks > runnableTick ?
+                        FastSteadyClock::ticks_to_ns(lastTicks - runnableTick) : 0);
+                runnableTick = 0;
+            }
+        } else if (cpuAccounting && !lastTicks)
+            lastTicks = FastSteadyClock::ticks();
+
+        TracePoint(eTraceEvent::swapIn, runningTask_->id_, 0, id_);
+        runningTask_->SwapIn(sharedStack_);
+        tb.task_ = nullptr;
+        TracePoint(eTraceEvent::swapOut, runningTask_->id_, (uint64_t)runningTask_->state_);
+
+        if (cpuAccounting || coroStat) {
+            uint64_t now = FastSteadyClock::ticks();
+            uint64_t ticks = now - lastTicks;
+            lastTicks = now;
+            if (cpuAccounting) {
+                uint32_t slice = (uint32_t)(std::min<uint64_t>)(ticks, (std::numeric_limits<uint32_t>::max)());
+                Task* tk = runningTask_;
+                // 平均时间片按1/8的权重衰减, 第一个时间片直接作为初值
+                tk->sliceTicks_ = tk->sliceTicks_ ? tk->sliceTicks_ - (tk->sliceTicks_ >> 3) + (slice >> 3) : slice;
+                busyTicks_ = busyTicks_ + ticks;
+            }
+            if (UNLIKELY(coroStat))
+                stats_.sliceLength_.Add(FastSteadyClock::ticks_to_ns(ticks));
+        }
 
 #if ENABLE_DEBUGGER
-            DebugPrint(dbg_switch, "leave task(%s) state=%d", runningTask_->DebugInfo(), (int)runningTask_->state_);
+        DebugPrint(dbg_switch, "leave task(%s) state=%d", runningTask_->DebugInfo(), (int)runningTask_->state_);
 #endif
 
-            switch (runningTask_->state_) {
-                case TaskState::runnable:
+        switch (runningTask_->state_) {
+            case TaskState::runnable:
+                {
+                    // 时间片用完, 重新排队(同优先级队列的尾部, 或按截止时间插入)
+                    std::unique_lock<TaskQueue::lock_t> lock(runnableLock_);
+                    RunnableQueueOf(runningTask_).eraseWithoutLock(runningTask_, false, false);
+                    PushRunnableWithoutLock(runningTask_, false);
+                    if (UNLIKELY(coroStat))
+                        TaskRefRunnableTick(runningTask_) = lastTicks;
+                    runningTask_ = nullptr;
+                }
+                break;
+
+            case TaskState::block:
+                {
+                    // SuspendBySelf时已经移入waitQueue_
+                    Task* tk = runningTask_;
                     {
-                        std::unique_lock<TaskQueue::lock_t> lock(runnableQueue_.LockRef());
-                        auto next = (Task*)runningTask_->next;
-                        if (next) {
-                            runningTask_ = next;
-                            runningTask_->check_ = runnableQueue_.check_;
-                            break;
-                        }
-
-                        if (addNewQuota_ < 1 || newQueue_.emptyUnsafe()) {
-                            runningTask_ = nullptr;
-                        } else {
-                            lock.unlock();
-                            if (AddNewTasks()) {
-                                runnableQueue_.next(runningTask_, runningTask_);
-                                -- addNewQuota_;
-                            } else {
-                                std::unique_lock<TaskQueue::lock_t> lock2(runnableQueue_.LockRef());
-                                runningTask_ = nullptr;
-                            }
-                        }
-
+                        std::unique_lock<TaskQueue::lock_t> lock(runnableLock_);
+                        runningTask_ = nullptr;
                     }
-                    break;
 
-                case TaskState::block:
+                    if (UNLIKELY(tk->lightOwner_ != nullptr))
+                        tk->lightOwner_->ReleaseLightRunner(tk);
+                }
+                break;
+
+            case TaskState::done:
+            default:
+                {
+                    Task* tk = runningTask_;
+                    DebugPrint(dbg_task, "task(%s) done.", tk->DebugInfo());
+                    tk->ctx_.ReleaseSharedStack(sharedStack_);
                     {
-                        std::unique_lock<TaskQueue::lock_t> lock(runnableQueue_.LockRef());
-                        runningTask_ = nextTask_;
-                        nextTask_ = nullptr;
+                        std::unique_lock<TaskQueue::lock_t> lock(runnableLock_);
+                        RunnableQueueOf(tk).eraseWithoutLock(tk);
+                        runningTask_ = nullptr;
                     }
-                    break;
 
-                case TaskState::done:
-                default:
-                    {
-                        runnableQueue_.next(runningTask_, nextTask_);
-                        if (!nextTask_ && addNewQuota_ > 0) {
-                            if (AddNewTasks()) {
-                                runnableQueue_.next(runningTask_, nextTask_);
-                                -- addNewQuota_;
-                            }
-                        }
-
-                        DebugPrint(dbg_task, "task(%s) done.", runningTask_->DebugInfo());
-                        runnableQueue_.erase(runningTask_);
-                        if (gcQueue_.size() > 16)
-                            GC();
-                        gcQueue_.push(runningTask_);
-                        if (runningTask_->eptr_) {
-                            std::exception_ptr ep = runningTask_->eptr_;
-                            std::rethrow_exception(ep);
-                        }
-
-                        std::unique_lock<TaskQueue::lock_t> lock(runnableQueue_.LockRef());
-                        runningTask_ = nextTask_;
-                        nextTask_ = nullptr;
+                    if (gcQueue_.size() > 16)
+                        GC();
+                    gcQueue_.push(tk);
+                    if (tk->eptr_) {
+                        std::exception_ptr ep = tk->eptr_;
+                        std::rethrow_exception(ep);
                     }
-                    break;
-            }
+                }
+                break;
         }
     }
 }
 
-Task* Processer::GetCurrentTask()
-{
-    auto proc = GetCurrentProcesser();
-    return proc ? proc->runningTask_ : nullptr;
-}
-
 bool Processer::IsCoroutine()
 {
     return !!GetCurrentTask();
@@ -189,23 +330,135 @@ bool Processer::IsCoroutine()
 
 std::size_t Processer::RunnableSize()
 {
-    return runnableQueue_.size() + newQueue_.size();
+    std::size_t n;
+    {
+        std::unique_lock<TaskQueue::lock_t> lock(runnableLock_);
+        n = RunnableSizeWithoutLock();
+    }
+    return n + newQueue_.size();
+}
+
+std::size_t Processer::RunnableSizeWithoutLock()
+{
+    std::size_t n = 0;
+    for (int i = 0; i < s_levelCount; ++i)
+        n += levels_[i]->count_;
+    return n;
+}
+
+void Processer::PushRunnableWithoutLock(Task* tk, bool refCount)
+{
+    if (tk->HasDeadline()) {
+        deadlineQueue_.insertSortedWithoutLock(tk, [](Task* lhs, Task* rhs) {
+                    return lhs->deadline_ < rhs->deadline_;
+                }, refCount);
+        return ;
+    }
+
+    runnableQueues_[tk->priority_].pushWithoutLock(tk, refCount);
+}
+
+Task* Processer::PickRunnableWithoutLock()
+{
+    CoroutineOptions & opt = CoroutineOptions::getInstance();
+    uint32_t agingQuota = opt.priority_aging_quota;
+    int first = -1, level = -1;
+    for (int i = 0; i < s_levelCount; ++i) {
+        if (levels_[i]->emptyUnsafe()) {
+            starvation_[i] = 0;
+            continue;
+        }
+
+        if (level == -1) {
+            first = level = i;
+            continue;
+        }
+
+        // 低优先级队列被插队次数达到阈值, 让它执行一次
+        if (agingQuota && ++starvation_[i] >= agingQuota)
+            level = i;
+    }
+
+    if (level == -1) return nullptr;
+
+    starvation_[level] = 0;
+    Task* tk = nullptr;
+
+    // runnext只在同级队列中插队, 不越过更高优先级的协程, 也不打断老化
+    Task* next = runnext_;
+    runnext_ = nullptr;
+    if (next && level == first && levels_[level] == &RunnableQueueOf(next)
+            && runnextStreak_ < opt.runnext_quota) {
+        ++ runnextStreak_;
+        return next;
+    }
+    runnextStreak_ = 0;
+
+    levels_[level]->nextWithoutLock((Task*)levels_[level]->head_, tk);
+
+    if (tk->HasDeadline() && !tk->deadlineExpired_ && tk->deadline_ < FastSteadyClock::now()) {
+        tk->deadlineExpired_ = true;
+        ++ expiredDeadlineCount_;
+        DebugPrint(dbg_scheduler, "task(%s) deadline expired.", tk->DebugInfo());
+    }
+    return tk;
 }
 
 void Processer::WaitCondition()
 {
     GC();
-    std::unique_lock<TaskQueue::lock_t> lock(newQueue_.LockRef());
-    if (notified_) {
-        DebugPrint(dbg_scheduler, "WaitCondition by Notified. [Proc(%d)] --------------------------", id_);
-        notified_ = false;
+    idleSinceTick_ = NowMicrosecond();
+    if (SpinWait()) {
+        parker_.Reset();
         return ;
     }
 
-    waiting_ = true;
+    if (retiring_)
+        return ;
+
+    // 挂起前已经有Unpark时立即返回
     DebugPrint(dbg_scheduler, "WaitCondition. [Proc(%d)] --------------------------", id_);
-    cv_.wait(lock);
-    waiting_ = false;
+    if (CoroutineOptions::getInstance().enable_coro_stat)
+        ++stats_.parks_;
+    parker_.Park();
+
+    // 空闲时长包含自旋的时间
+    int64_t idle = NowMicrosecond() - idleSinceTick_;
+    avgIdle_.Add(idle);
+
+    // dispatcher线程可能因为所有P都空闲而休眠了
+    scheduler_->NotifyDispatcher();
+}
+
+bool Processer::SpinWait()
+{
+    CoroutineOptions & opt = CoroutineOptions::getInstance();
+    int64_t budget = opt.processer_spin_us;
+    if (!budget)
+        return false;
+
+    if (opt.processer_spin_adaptive)
+        budget = avgIdle_.SpinBudget(budget);
+
+    // 自旋期间没有挂起, 生产者的Unpark只是一次原子交换
+    int64_t now = idleSinceTick_;
+    for (int i = 0; now - idleSinceTick_ < budget; ++i) {
+        if (parker_.IsNotified() || !newQueue_.emptyUnsafe() || retiring_ || scheduler_->IsStop()) {
+            now = NowMicrosecond();
+            avgIdle_.Add(now - idleSinceTick_);
+            return true;
+        }
+
+        if ((now - idleSinceTick_) * 2 < budget)
+            CpuRelax();
+        else
+            std::this_thread::yield();
+
+        if ((i & 0xf) == 0xf)
+            now = NowMicrosecond();
+    }
+
+    return false;
 }
 
 void Processer::GC()
@@ -219,8 +472,14 @@ void Processer::GC()
 
 bool Processer::AddNewTasks()
 {
-    runnableQueue_.push(newQueue_.pop_all());
+    SList<Task> slist = newQueue_.pop_all();
     newQueue_.AssertLink();
+    if (slist.empty()) return false;
+
+    // 按截止时间和优先级分发到各级runnable队列
+    std::unique_lock<TaskQueue::lock_t> lock(runnableLock_);
+    while (Task* tk = slist.pop_front())
+        PushRunnableWithoutLock(tk, false);
     return true;
 }
 
@@ -238,6 +497,41 @@ void Processer::Mark()
     }
 }
 
+void Processer::SampleCpuTime()
+{
+    uint64_t busy = busyTicks_;
+    uint64_t switchCount = switchCount_;
+    uint64_t switches = switchCount - sampleSwitch_;
+    if (switches == 0)
+        return ;
+
+    // 这个周期内的平均时间片长度, 再按1/8的权重衰减到sliceNs_中.
+    // 用总时长/切换次数而不是逐个时间片衰减, 少量长时间片和大量短时间片混合时也能反映真实的cpu占用.
+    uint64_t ns = FastSteadyClock::ticks_to_ns(busy - sampleBusyTicks_) / switches;
+    sliceNs_ = sliceNs_ ? sliceNs_ - (sliceNs_ >> 3) + (ns >> 3) : ns;
+    sampleBusyTicks_ = busy;
+    sampleSwitch_ = switchCount;
+}
+
+std::size_t Processer::LoadUnit()
+{
+    if (!CoroutineOptions::getInstance().load_balance_by_cpu_time)
+        return 1;
+    return (std::max<std::size_t>)(sliceNs_ / 1000, 1);
+}
+
+std::size_t Processer::Load()
+{
+    return RunnableSize() * LoadUnit();
+}
+
+std::size_t Processer::TaskLoad(Task* tk)
+{
+    if (!CoroutineOptions::getInstance().load_balance_by_cpu_time)
+        return 1;
+    return (std::max<std::size_t>)(FastSteadyClock::ticks_to_ns(tk->sliceTicks_) / 1000, 1);
+}
+
 int64_t Processer::NowMicrosecond()
 {
     return std::chrono::duration_cast<std::chrono::microseconds>(FastSteadyClock::now().time_since_epoch()).count();
@@ -245,55 +539,63 @@ int64_t Processer::NowMicrosecond()
 
 SList<Task> Processer::Steal(std::size_t n)
 {
-    if (n > 0) {
-        // steal some
-        newQueue_.AssertLink();
-        auto slist = newQueue_.pop_back(n);
-        newQueue_.AssertLink();
-        if (slist.size() >= n)
-            return slist;
-
-        std::unique_lock<TaskQueue::lock_t> lock(runnableQueue_.LockRef());
-        bool pushRunningTask = false, pushNextTask = false;
-        if (runningTask_)
-            pushRunningTask = runnableQueue_.eraseWithoutLock(runningTask_, true) || slist.erase(runningTask_, newQueue_.check_);
-        if (nextTask_)
-            pushNextTask = runnableQueue_.eraseWithoutLock(nextTask_, true) || slist.erase(nextTask_, newQueue_.check_);
-        auto slist2 = runnableQueue_.pop_backWithoutLock(n - slist.size());
-        if (pushRunningTask)
-            runnableQueue_.pushWithoutLock(runningTask_);
-        if (pushNextTask)
-            runnableQueue_.pushWithoutLock(nextTask_);
-        lock.unlock();
-
-        slist2.append(std::move(slist));
-        if (!slist2.empty())
-            DebugPrint(dbg_scheduler, "Proc(%d).Stealed = %d", id_, (int)slist2.size());
-        return slist2;
-    } else {
-        // steal all
-        newQueue_.AssertLink();
-        auto slist = newQueue_.pop_all();
-        newQueue_.AssertLink();
+    // 绑定了P(affinity)的协程不能被偷走, 部分steal时刚被唤醒的runnext协程也留在本P上执行
+    Task* next = nullptr;
+    auto stealable = [&next](Task* tk) { return tk != next && !TaskRefAffinity(tk); };
 
-        std::unique_lock<TaskQueue::lock_t> lock(runnableQueue_.LockRef());
-        bool pushRunningTask = false, pushNextTask = false;
-        if (runningTask_)
-            pushRunningTask = runnableQueue_.eraseWithoutLock(runningTask_, true) || slist.erase(runningTask_, newQueue_.check_);
-        if (nextTask_)
-            pushNextTask = runnableQueue_.eraseWithoutLock(nextTask_, true) || slist.erase(nextTask_, newQueue_.check_);
-        auto slist2 = runnableQueue_.pop_allWithoutLock();
-        if (pushRunningTask)
-            runnableQueue_.pushWithoutLock(runningTask_);
-        if (pushNextTask)
-            runnableQueue_.pushWithoutLock(nextTask_);
-        lock.unlock();
+    // n为0时steal全部
+    std::size_t limit = n ? n : (std::numeric_limits<std::size_t>::max)();
+    newQueue_.AssertLink();
+    auto slist = newQueue_.pop_if(limit, stealable);
+    newQueue_.AssertLink();
+    if (n > 0 && slist.size() >= n) {
+        if (CoroutineOptions::getInstance().enable_coro_stat)
+            stats_.stealOut_ += slist.size();
+        TracePoint(eTraceEvent::steal, 0, slist.size(), id_);
+        return slist;
+    }
 
-        slist2.append(std::move(slist));
-        if (!slist2.empty())
-            DebugPrint(dbg_scheduler, "Proc(%d).Stealed all = %d", id_, (int)slist2.size());
-        return slist2;
+    std::unique_lock<TaskQueue::lock_t> lock(runnableLock_);
+    if (n == 0)
+        runnext_ = nullptr;
+    else
+        next = runnext_;
+
+    bool pushRunningTask = false;
+    if (runningTask_)
+        pushRunningTask = RunnableQueueOf(runningTask_).eraseWithoutLock(runningTask_, true) || slist.erase(runningTask_, newQueue_.check_);
+
+    // 结果按紧急程度从高到低排列.
+    // 部分steal时: 先偷最紧急的有截止时间的协程, 让它们尽快在空闲的P上执行;
+    //              再从低到高偷各优先级的协程, 紧急的协程留在原P上尽快执行.
+    SList<Task> levels[s_levelCount];
+    std::size_t stealed = slist.size();
+    if (n == 0) {
+        for (int i = 0; i < s_levelCount; ++i)
+            levels[i] = levels_[i]->pop_ifWithoutLock(limit, stealable, false);
+    } else {
+        levels[0] = deadlineQueue_.pop_ifWithoutLock(n - stealed, stealable, false);
+        stealed += levels[0].size();
+        for (int i = s_levelCount - 1; i > 0 && stealed < n; --i) {
+            levels[i] = levels_[i]->pop_ifWithoutLock(n - stealed, stealable);
+            stealed += levels[i].size();
+        }
     }
+    if (pushRunningTask)
+        PushRunnableWithoutLock(runningTask_, true);
+    lock.unlock();
+
+    SList<Task> result;
+    for (int i = 0; i < s_levelCount; ++i)
+        result.append(std::move(levels[i]));
+    result.append(std::move(slist));
+    if (!result.empty())
+        DebugPrint(dbg_scheduler, "Proc(%d).Stealed%s = %d", id_, n ? "" : " all", (int)result.size());
+    if (CoroutineOptions::getInstance().enable_coro_stat)
+        stats_.stealOut_ += result.size();
+    if (!result.empty())
+        TracePoint(eTraceEvent::steal, 0, result.size(), id_);
+    return result;
 }
 
 Processer::SuspendEntry Processer::Suspend()
@@ -315,15 +617,17 @@ Processer::SuspendEntry Processer::Suspend(FastSteadyClock::time_point timepoint
     SuspendEntry entry = Suspend();
     Task* tk = GetCurrentTask();
     if (tk->isInTimer_) {
-        tk->schedTimer_->join_unschedule(tk->suspendTimerId_);
+        tk->schedTimer_->join_unschedule(*tk->suspendTimerId_);
         tk->schedTimer_ = nullptr;
     } else {
         tk->isInTimer_ = true;
     }
 
     tk->schedTimer_ = &GetCurrentScheduler()->GetTimer();
-    tk->schedTimer_->schedule(tk->suspendTimerId_, timepoint,
-            [entry, tk]() mutable {
+    uint64_t taskId = tk->id_;
+    tk->schedTimer_->schedule(tk->SuspendTimerId(), timepoint,
+            [entry, tk, taskId]() mutable {
+                TracePoint(eTraceEvent::timer, taskId);
                 Processer::Wakeup(entry, [tk]{
                         tk->isInTimer_ = false;
                         tk->schedTimer_ = nullptr;
@@ -340,11 +644,11 @@ Processer::SuspendEntry Processer::SuspendBySelf(Task* tk)
     tk->state_ = TaskState::block;
     uint64_t id = ++ TaskRefSuspendId(tk);
 
-    std::unique_lock<TaskQueue::lock_t> lock(runnableQueue_.LockRef());
-    runnableQueue_.nextWithoutLock(runningTask_, nextTask_);
-    runnableQueue_.eraseWithoutLock(runningTask_, false, false);
+    std::unique_lock<TaskQueue::lock_t> lock(runnableLock_);
+    RunnableQueueOf(tk).eraseWithoutLock(runningTask_, false, false);
 
-    DebugPrint(dbg_suspend, "tk(%s) Suspend. nextTask(%s)", tk->DebugInfo(), nextTask_->DebugInfo());
+    DebugPrint(dbg_suspend, "tk(%s) Suspend.", tk->DebugInfo());
+    TracePoint(eTraceEvent::suspend, tk->id_);
     waitQueue_.pushWithoutLock(runningTask_, false);
     return SuspendEntry{ WeakPtr<Task>(tk), id };
 }
@@ -381,21 +685,91 @@ bool Processer::WakeupBySelf(IncursivePtr<Task> const& tkPtr, uint64_t id, std::
 
     if (tk->isInTimer_) {
         tk->isInTimer_ = false;
-        tk->schedTimer_->join_unschedule(tk->suspendTimerId_);
+        tk->schedTimer_->join_unschedule(*tk->suspendTimerId_);
         tk->schedTimer_ = nullptr;
     }
 
     bool ret = waitQueue_.eraseWithoutLock(tk, false, false);
     (void)ret;
     assert(ret);
-    size_t sizeAfterPush = runnableQueue_.pushWithoutLock(tk, false);
+
+    Processer* target = WakeTargetWithoutLock(tk);
+    if (target == this) {
+        PushWokenWithoutLock(tk, lock);
+        return true;
+    }
+
+    // 迁移到其他P: 先释放本P的锁, 两个P的runnableLock_不同时持有
+    lock.unlock();
+    DebugPrint(dbg_suspend, "tk(%s) Wakeup. migrate from proc(%d) to proc(%d)",
+            tk->DebugInfo(), id_, target->id_);
+    std::unique_lock<TaskQueue::lock_t> targetLock(target->runnableLock_);
+    target->PushWokenWithoutLock(tk, targetLock);
+    return true;
+}
+
+void Processer::PushWokenWithoutLock(Task* tk, std::unique_lock<TaskQueue::lock_t> & lock)
+{
+    PushRunnableWithoutLock(tk, false);
+
+    TracePoint(eTraceEvent::wakeup, tk->id_, GetCurrentTask() ? GetCurrentTask()->id_ : 0, id_);
+
+    if (CoroutineOptions::getInstance().enable_coro_stat) {
+        TaskRefRunnableTick(tk) = FastSteadyClock::ticks();
+        if (GetCurrentProcesser() == this)
+            ++stats_.wakeupLocal_;
+        else
+            ++stats_.wakeupRemote_;
+    }
+
+    // 本P上的协程唤醒的, 下一个执行(有截止时间的协程仍然按EDF顺序)
+    if (GetCurrentTask() && GetCurrentProcesser() == this && !tk->HasDeadline()
+            && CoroutineOptions::getInstance().runnext_quota)
+        runnext_ = tk;
+
+    size_t sizeAfterPush = RunnableSizeWithoutLock();
     DebugPrint(dbg_suspend, "tk(%s) Wakeup. tk->state_ = %s. is-in-proc(%d). sizeAfterPush=%lu",
             tk->DebugInfo(), GetTaskStateName(tk->state_), GetCurrentProcesser() == this, sizeAfterPush);
     if (sizeAfterPush == 1 && GetCurrentProcesser() != this) {
         lock.unlock();
         NotifyCondition();
     }
-    return true;
+}
+
+Processer* Processer::WakeTargetWithoutLock(Task* tk)
+{
+    CoroutineOptions & opt = CoroutineOptions::getInstance();
+    if (opt.wake_placement == eWakePlacement::original)
+        return this;
+
+    // 还没有切出(挂起后立即被唤醒), 或者就是在本P上唤醒的(走runnext)
+    Processer* current = GetCurrentProcesser();
+    if (runningTask_ == tk || current == this)
+        return this;
+
+    // 原P空闲并且醒着: 不需要跨线程唤醒, 缓存也还是热的
+    bool asleep = dormant_ || IsWaiting();
+    if (!asleep && !runningTask_)
+        return this;
+
+    if (TaskRefAffinity(tk))
+        return this;
+
+    int64_t now = NowMicrosecond();
+    int64_t & lastMigrate = TaskRefWakeMigrateTick(tk);
+    if (lastMigrate && now - lastMigrate < (int64_t)opt.wake_migrate_interval_us)
+        return this;
+
+    Processer* target = nullptr;
+    if (opt.wake_placement == eWakePlacement::idle)
+        target = scheduler_->SelectIdleProcesser(this);
+    if (!target && current && current->scheduler_ == scheduler_ && current->active_)
+        target = current;
+    if (!target)
+        return this;
+
+    lastMigrate = now;
+    return target;
 }
 
 } //namespace co
@@ -1,20 +1,42 @@
 #pragma once
 #include "../common/config.h"
 #include "../common/clock.h"
+#include "../common/tls_block.h"
 #include "../task/task.h"
 #include "../common/ts_queue.h"
+#include "../common/parker.h"
+#include "sched_stats.h"
 
 #if ENABLE_DEBUGGER
 #include "../debug/listener.h"
 #endif
-#include <condition_variable>
 #include <mutex>
 #include <atomic>
+#include <deque>
 
 namespace co {
 
 class Scheduler;
 
+// 空闲时长的滑动平均值(单位：微秒, 新样本权重1/8), 用于调整自旋时长.
+// 按8倍定点保存, 避免整数除法把小于8us的差值截断为0, 使得短间隔时平均值一直停在0.
+struct IdleAverage
+{
+    int64_t scaled_ = 0;    // 平均值 * 8
+
+    ALWAYS_INLINE void Add(int64_t us) { scaled_ += us - (scaled_ >> 3); }
+
+    ALWAYS_INLINE int64_t Us() const { return scaled_ >> 3; }
+
+    // 自适应的自旋时长: 平均空闲时长的2倍, 不超过limit. 平均空闲时长超过limit时不自旋.
+    int64_t SpinBudget(int64_t limit) const
+    {
+        if (Us() > limit)
+            return 0;
+        return (std::min<int64_t>)(limit, (scaled_ >> 2) + 1);
+    }
+};
+
 // 协程执行器
 // 对应一个线程, 负责本线程的协程调度, 非线程安全.
 class Processer
@@ -27,16 +49,26 @@ private:
     // 线程ID
     int id_;
 
+    // 绑定的CPU和所在的NUMA节点, 未绑定时为-1
+    int cpu_ = -1;
+    int numaNode_ = -1;
+
     // 激活态
     // 非激活的P仅仅是不能接受新的协程加入, 仍然可以强行AddTask并正常处理.
     volatile bool active_ = true;
 
+    // 休眠态: 多余的P空闲超时后退出线程, 对象保留以便复用.
+    // 休眠的P被强行AddTask时会自动重新启动线程.
+    std::atomic_bool dormant_{false};
+
+    // 调度线程要求这个P在没有任何协程时退出线程
+    volatile bool retiring_ = false;
+
+    // 开始空闲等待的时间戳(Dispatch线程专用)
+    volatile int64_t idleSinceTick_ = 0;
+
     // 当前正在运行的协程
     Task* runningTask_{nullptr};
-    Task* nextTask_{nullptr};
-
-    // 每轮调度只加有限次数新协程, 防止新协程创建新协程产生死循环
-    int addNewQuota_ = 0;
 
     // 当前正在运行的协程本次调度开始的时间戳(Dispatch线程专用)
     volatile int64_t markTick_ = 0;
@@ -45,32 +77,79 @@ private:
     // 协程调度次数
     volatile uint64_t switchCount_ = 0;
 
+    // 执行协程累计占用的cpu时间(FastSteadyClock::ticks计数), P线程写, 调度线程读
+    volatile uint64_t busyTicks_ = 0;
+
+    // 调度线程上次采样时的busyTicks_和switchCount_, 以及指数衰减的平均时间片长度(纳秒)
+    // (Dispatch线程专用)
+    uint64_t sampleBusyTicks_ = 0;
+    uint64_t sampleSwitch_ = 0;
+    uint64_t sliceNs_ = 0;
+
     // 协程队列
+    // 多级runnable队列按优先级分开存放, 与waitQueue_共用同一把锁
+    // 有截止时间的协程按截止时间排序, 单独存放于deadlineQueue_, 先于各优先级队列调度(EDF)
     typedef TSQueue<Task, true> TaskQueue;
-    TaskQueue runnableQueue_;
+    TaskQueue::lock_t runnableLock_;
+    TaskQueue deadlineQueue_;
+    TaskQueue runnableQueues_[prio_count];
     TaskQueue waitQueue_;
+
+    // 调度顺序: deadlineQueue_, runnableQueues_[prio_high ... prio_low]
+    static const int s_levelCount = prio_count + 1;
+    TaskQueue* levels_[s_levelCount];
+
+    // 每级队列因更高级别插队而被跳过的次数(老化计数)
+    uint32_t starvation_[s_levelCount] = {};
+
+    // 本P上的协程最近唤醒的协程, 下一次调度优先执行它(仍然在runnable队列中, 只是插队).
+    // 部分steal时不会被偷走. runnableLock_保护.
+    Task* runnext_ = nullptr;
+
+    // 连续通过runnext调度的次数
+    uint32_t runnextStreak_ = 0;
+
+    // 调度统计(enable_coro_stat)
+    ProcesserStats stats_;
+
+    // 超过截止时间才开始执行的协程数
+    volatile uint64_t expiredDeadlineCount_ = 0;
     TSQueue<Task, false> gcQueue_;
 
     TaskQueue newQueue_;
 
-    // 等待的条件变量
-    std::condition_variable_any cv_;
-    std::atomic_bool waiting_{false};
-    bool notified_ = false;
+    // 空闲时挂起线程, 生产者只在P确实挂起时才进入内核唤醒
+    Parker parker_;
+
+    // 轻量任务(go_light)队列
+    // 不为每个任务创建协程, 而是由一个执行协程(lightRunner_)依次执行.
+    // 执行协程因某个任务阻塞时, 这个任务就地升级为普通协程, 剩余的任务交给新的执行协程.
+    LFLock lightLock_;
+    std::deque<TaskF> lightQueue_;
+    Task* lightRunner_ = nullptr;
+
+    // 执行协程在锁外创建, 创建期间lightRunner_为此标记, 其他投递者不会重复创建
+    static const std::size_t kLightRunnerCreating = (std::size_t)-1;
+
+    // 共享栈模式的协程都在这块栈上运行, 首次使用时才分配
+    SharedStack sharedStack_;
+
+    // 空闲时长的滑动平均值, 用于调整自旋时长
+    IdleAverage avgIdle_;
 
     static int s_check_;
 
 public:
     ALWAYS_INLINE int Id() { return id_; }
 
-    static Processer* & GetCurrentProcesser();
+    ALWAYS_INLINE static Processer* & GetCurrentProcesser() { return GetTlsBlock().proc_; }
 
     static Scheduler* GetCurrentScheduler();
 
     inline Scheduler* GetScheduler() { return scheduler_; }
 
     // 获取当前正在执行的协程
-    static Task* GetCurrentTask();
+    ALWAYS_INLINE static Task* GetCurrentTask() { return GetTlsBlock().task_; }
 
     // 是否在协程中
     static bool IsCoroutine();
@@ -123,6 +202,28 @@ private:
     // 暂兼用于负载指数
     std::size_t RunnableSize();
 
+    // 负载指数: 待执行协程数 x 每个协程的负载权重(LoadUnit)
+    std::size_t Load();
+
+    // 本P上一个协程的负载权重: 平均时间片长度(微秒), 至少为1.
+    // 关闭load_balance_by_cpu_time时为1, 负载就是协程数.
+    std::size_t LoadUnit();
+
+    // 单个协程的负载权重, 按它自己的平均时间片长度计算
+    static std::size_t TaskLoad(Task* tk);
+
+    // 调度线程每个周期调用一次: 用这个周期内的平均时间片长度更新sliceNs_
+    void SampleCpuTime();
+
+    // 不加锁读取各队列的计数器, 得到待执行协程数量的估计值, 用于选择P
+    ALWAYS_INLINE std::size_t RunnableSizeUnsafe()
+    {
+        std::size_t n = newQueue_.count_;
+        for (int i = 0; i < s_levelCount; ++i)
+            n += levels_[i]->count_;
+        return n;
+    }
+
     ALWAYS_INLINE void CoYield();
 
     // 新创建、阻塞后触发的协程add进来
@@ -134,11 +235,14 @@ private:
     // 偷来的协程add进来
     void AddTask(SList<Task> && slist);
 
+    // dispatcher负载均衡时分配过来的协程, 计入stealIn_统计
+    void AddStolenTasks(SList<Task> && slist);
+
     void NotifyCondition();
 
     // 是否处于等待状态(无runnable协程)
     // 调度线程会尽量分配协程过来
-    ALWAYS_INLINE bool IsWaiting() { return waiting_; }
+    ALWAYS_INLINE bool IsWaiting() { return parker_.IsParked(); }
 
     // 单个协程执行时长超过预设值, 则判定为阻塞状态
     // 阻塞状态不再加入新的协程, 并由调度线程steal走所有协程(正在执行的除外)
@@ -151,6 +255,20 @@ private:
 private:
     void WaitCondition();
 
+    // 按截止时间和优先级(含老化规则)选出下一个要执行的协程, 需持有runnableLock_
+    Task* PickRunnableWithoutLock();
+
+    // 协程所属的runnable队列
+    ALWAYS_INLINE TaskQueue& RunnableQueueOf(Task* tk)
+    {
+        return tk->HasDeadline() ? deadlineQueue_ : runnableQueues_[tk->priority_];
+    }
+
+    // 加入runnable队列, 需持有runnableLock_
+    void PushRunnableWithoutLock(Task* tk, bool refCount);
+
+    std::size_t RunnableSizeWithoutLock();
+
     void GC();
 
     bool AddNewTasks();
@@ -158,11 +276,41 @@ private:
     // 调度线程打标记, 用于检测阻塞
     void Mark();
 
-    int64_t NowMicrosecond();
+    // 按processer_cpus配置绑定当前线程
+    void BindCpu();
+
+    // 加入一个轻量任务
+    void AddLightTask(TaskF && fn);
+
+    // 创建执行协程并加入可执行队列. 调用前lightRunner_已置为kLightRunnerCreating
+    void StartLightRunner();
+
+    // 执行协程的函数体
+    void RunLightTasks();
+
+    // 执行协程阻塞或异常退出时, 把剩余的轻量任务交给新的执行协程
+    void ReleaseLightRunner(Task* tk);
+
+    // 挂起线程前先自旋等待一段时间, 返回是否等到了新任务
+    bool SpinWait();
+
+    // 没有任何协程时进入休眠态, 返回是否休眠成功
+    bool TryRetire();
+
+    // 休眠态的P加入了新协程, 重新启动线程
+    void ReviveIfDormant();
+
+    static int64_t NowMicrosecond();
 
     SuspendEntry SuspendBySelf(Task* tk);
 
     bool WakeupBySelf(IncursivePtr<Task> const& tkPtr, uint64_t id, std::function<void()> const& functor);
+
+    // 按wake_placement策略选择被唤醒的协程在哪个P上执行, 需在runnableLock_内调用
+    Processer* WakeTargetWithoutLock(Task* tk);
+
+    // 把被唤醒的协程加入本P的runnable队列, 需在runnableLock_内调用, 需要通知P时会释放锁
+    void PushWokenWithoutLock(Task* tk, std::unique_lock<TaskQueue::lock_t> & lock);
 };
 
 ALWAYS_INLINE void Processer::StaticCoYield()
@@ -9,6 +9,8 @@ namespace co
 TaskRefDefine(bool, Affinity)
 TaskRefDefine(SourceLocation, Location)
 TaskRefDefine(std::string, DebugInfo)
+TaskRefDefine(int64_t, WakeMigrateTick)
+TaskRefDefine(uint64_t, RunnableTick)
 //TaskRefDefine(atomic_t<uint64_t>, SuspendId)
 
 #define TaskRefSuspendId(tk) tk->suspendId_
@@ -0,0 +1,109 @@
+#pragma once
+#include "../common/config.h"
+#include <vector>
+
+namespace co
+{
+
+// 按2的幂分桶的时长直方图(单位：纳秒)
+// 第i个桶统计[2^i, 2^(i+1))纳秒, 0落在第0个桶. 记录只需要一次clz和几次加法.
+struct LatencyHistogram
+{
+    static const int s_bucketCount = 40;    // 最大约1100秒
+
+    uint64_t buckets_[s_bucketCount] = {};
+    uint64_t count_ = 0;
+    uint64_t sumNs_ = 0;
+    uint64_t maxNs_ = 0;
+
+    ALWAYS_INLINE void Add(uint64_t ns)
+    {
+        int idx = ns ? 63 - __builtin_clzll(ns) : 0;
+        if (idx >= s_bucketCount)
+            idx = s_bucketCount - 1;
+        ++buckets_[idx];
+        ++count_;
+        sumNs_ += ns;
+        if (ns > maxNs_)
+            maxNs_ = ns;
+    }
+
+    void Merge(LatencyHistogram const& other)
+    {
+        for (int i = 0; i < s_bucketCount; ++i)
+            buckets_[i] += other.buckets_[i];
+        count_ += other.count_;
+        sumNs_ += other.sumNs_;
+        if (other.maxNs_ > maxNs_)
+            maxNs_ = other.maxNs_;
+    }
+
+    uint64_t AvgNs() const { return count_ ? sumNs_ / count_ : 0; }
+
+    // 分位数(0 - 1), 返回所在桶的上界, 不超过最大值
+    uint64_t PercentileNs(double p) const
+    {
+        if (!count_) return 0;
+        uint64_t rank = (uint64_t)(p * count_);
+        if (rank >= count_) rank = count_ - 1;
+        uint64_t seen = 0;
+        for (int i = 0; i < s_bucketCount; ++i) {
+            seen += buckets_[i];
+            if (seen > rank) {
+                uint64_t upper = (uint64_t(2) << i) - 1;
+                return upper < maxNs_ ? upper : maxNs_;
+            }
+        }
+        return maxNs_;
+    }
+};
+
+// 单个P的调度统计, 开启enable_coro_stat时才记录.
+// 各字段只由一个线程写(P线程, dispatcher线程, 或者持有P的runnableLock_的唤醒方),
+// 读取时不加锁, 得到的是近似的快照.
+struct ProcesserStats
+{
+    // 协程切换次数
+    uint64_t switches_ = 0;
+
+    // 负载均衡时被dispatcher偷走/分配进来的协程数
+    uint64_t stealOut_ = 0;
+    uint64_t stealIn_ = 0;
+
+    // 唤醒次数: 本P上的协程唤醒的 / 其他线程唤醒的
+    uint64_t wakeupLocal_ = 0;
+    uint64_t wakeupRemote_ = 0;
+
+    // 空闲时挂起线程的次数(不含自旋等到任务的情况)
+    uint64_t parks_ = 0;
+
+    // 协程从进入可执行状态(创建、唤醒、让出)到开始执行的时长
+    LatencyHistogram runQueueLatency_;
+
+    // 每次执行的时间片长度
+    LatencyHistogram sliceLength_;
+
+    void Merge(ProcesserStats const& other)
+    {
+        switches_ += other.switches_;
+        stealOut_ += other.stealOut_;
+        stealIn_ += other.stealIn_;
+        wakeupLocal_ += other.wakeupLocal_;
+        wakeupRemote_ += other.wakeupRemote_;
+        parks_ += other.parks_;
+        runQueueLatency_.Merge(other.runQueueLatency_);
+        sliceLength_.Merge(other.sliceLength_);
+    }
+};
+
+// Scheduler::GetStats的结果
+struct SchedulerStats
+{
+    // 所有P的合计
+    ProcesserStats total_;
+
+    // 按P的下标排列
+    std::vector<ProcesserStats> processers_;
+};
+
+} // namespace co
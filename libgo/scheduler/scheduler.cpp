@@ -1,11 +1,13 @@
 #include "scheduler.h"
 #include "../common/error.h"
 #include "../common/clock.h"
+#include "../common/cpu_affinity.h"
 #include <stdio.h>
 #include <system_error>
 #include <unistd.h>
 #include <time.h>
 #include "ref.h"
+#include "../debug/trace.h"
 #include <thread>
 
 namespace co
@@ -71,24 +73,105 @@ Scheduler::~Scheduler()
     Stop();
 }
 
-void Scheduler::CreateTask(TaskF const& fn, TaskOpt const& opt)
+void Scheduler::CreateTask(TaskF && fn, TaskOpt const& opt)
 {
-    Task* tk = new Task(fn, opt.stack_size_ ? opt.stack_size_ : CoroutineOptions::getInstance().stack_size);
+    ++taskCount_;
+    Task* tk = NewTask(std::move(fn), opt, ++GetTaskIdFactory());
+
+    if (opt.processer_ >= 0) {
+        // 指定了P的协程直接加入该P, 非激活的P也可以强行加入
+        PinnedProcesser(opt.processer_)->AddTask(tk);
+        return ;
+    }
+
+    AddTask(tk);
+}
+
+void Scheduler::CreateTasks(std::vector<TaskF> && fns, TaskOpt const& opt)
+{
+    std::size_t n = fns.size();
+    if (!n) return ;
+
+    // 一次性预留协程ID和计数
+    taskCount_ += n;
+    uint64_t id = (GetTaskIdFactory() += n) - n;
+
+    if (opt.processer_ >= 0) {
+        SList<Task> slist;
+        for (std::size_t i = 0; i < n; ++i)
+            slist.push_back(NewTask(std::move(fns[i]), opt, ++id));
+        PinnedProcesser(opt.processer_)->AddTask(std::move(slist));
+        return ;
+    }
+
+    // 均分给所有激活的P, 每个P只加一次锁、唤醒一次
+    std::vector<Processer*> targets;
+    Processer* current = Processer::GetCurrentProcesser();
+    if (current && current->active_ && current->GetScheduler() == this)
+        targets.push_back(current);
+
+    std::size_t pcount = processers_.size();
+    for (std::size_t i = 0; i < pcount; ++i) {
+        auto p = processers_[(lastActive_ + i) % pcount];
+        if (p != current && p->active_ && !p->dormant_)
+            targets.push_back(p);
+    }
+
+    if (targets.empty())
+        targets.push_back(SelectProcesser());
+
+    std::size_t chunk = (n + targets.size() - 1) / targets.size();
+    std::size_t i = 0;
+    for (Processer* p : targets) {
+        SList<Task> slist;
+        for (std::size_t end = (std::min)(i + chunk, n); i < end; ++i)
+            slist.push_back(NewTask(std::move(fns[i]), opt, ++id));
+        if (slist.empty())
+            break;
+        p->AddTask(std::move(slist));
+    }
+}
+
+void Scheduler::Post(TaskF && fn)
+{
+    SelectProcesser()->AddLightTask(std::move(fn));
+}
+
+Task* Scheduler::CreateLightRunner(Processer* p)
+{
+    TaskOpt opt;
+    opt.file_ = __FILE__;
+    opt.lineno_ = __LINE__;
+    ++taskCount_;
+    Task* tk = NewTask([p]{ p->RunLightTasks(); }, opt, ++GetTaskIdFactory());
+    tk->lightOwner_ = p;
+    return tk;
+}
+
+Task* Scheduler::NewTask(TaskF && fn, TaskOpt const& opt, uint64_t id)
+{
+    Task* tk = opt.sharedStack_
+        ? new Task(std::move(fn), SharedStackTag())
+        : new Task(std::move(fn), opt.stack_size_ ? opt.stack_size_ : CoroutineOptions::getInstance().stack_size);
 //    printf("new tk = %p  impl = %p\n", tk, tk->impl_);
     tk->SetDeleter(Deleter(&Scheduler::DeleteTask, this));
-    tk->id_ = ++GetTaskIdFactory();
-    TaskRefAffinity(tk) = opt.affinity_;
+    tk->id_ = id;
+    tk->priority_ = opt.priority_;
+    tk->deadline_ = opt.deadline_;
+    // 共享栈协程的栈数据只能恢复到原来的共享栈上, 必须绑定P
+    TaskRefAffinity(tk) = opt.affinity_ || opt.processer_ >= 0 || tk->ctx_.IsSharedStack();
     TaskRefLocation(tk).Init(opt.file_, opt.lineno_);
-    ++taskCount_;
+    if (CoroutineOptions::getInstance().enable_coro_stat)
+        TaskRefRunnableTick(tk) = FastSteadyClock::ticks();
 
     DebugPrint(dbg_task, "task(%s) created in scheduler(%p).", TaskDebugInfo(tk), (void*)this);
+    TracePoint(eTraceEvent::create, id, Processer::GetCurrentTask() ? Processer::GetCurrentTask()->id_ : 0);
 #if ENABLE_DEBUGGER
     if (Listener::GetTaskListener()) {
         Listener::GetTaskListener()->onCreated(tk->id_);
     }
 #endif
-
-    AddTask(tk);
+    return tk;
 }
 
 void Scheduler::DeleteTask(RefObject* tk, void* arg)
@@ -135,12 +218,15 @@ void Scheduler::Start(int minThreadNumber, int maxThreadNumber)
                 DebugPrint(dbg_thread, "Start dispatcher(sched=%p) thread id: %lu", (void*)this, NativeThreadID());
                 this->DispatcherThread();
                 });
+        BindThreadToCpus(t, CoroutineOptions::getInstance().timer_cpus);
         dispatchThread_.swap(t);
     } else {
         DebugPrint(dbg_scheduler, "---> No DispatcherThread");
     }
 
-    std::thread(FastSteadyClock::ThreadRun).detach();
+    std::thread clockThread(FastSteadyClock::ThreadRun);
+    BindThreadToCpus(clockThread, CoroutineOptions::getInstance().timer_cpus);
+    clockThread.detach();
 
     DebugPrint(dbg_scheduler, "Scheduler::Start minThreadNumber_=%d, maxThreadNumber_=%d", minThreadNumber_, maxThreadNumber_);
     mainProc->Process();
@@ -165,6 +251,12 @@ void Scheduler::Stop()
 
     if (timer_) timer_->stop();
 
+    {
+        std::unique_lock<std::mutex> lock(dispatchMtx_);
+        dispatcherParked_ = false;
+        dispatchCv_.notify_one();
+    }
+
     if (dispatchThread_.joinable())
         dispatchThread_.join();
 }
@@ -172,11 +264,13 @@ void Scheduler::UseAloneTimerThread()
 {
     if (!timer_) {
         timer_ = new TimerType;
+        BindThreadToCpus(timer_->thread(), CoroutineOptions::getInstance().timer_cpus);
     }
 }
 
 static Scheduler::TimerType& staticGetTimer() {
     static Scheduler::TimerType *ptimer = new Scheduler::TimerType;
+    BindThreadToCpus(ptimer->thread(), CoroutineOptions::getInstance().timer_cpus);
 
     std::unique_lock<std::mutex> lock(ExitListMtx());
     auto vec = ExitList();
@@ -191,16 +285,81 @@ Scheduler::TimerType & Scheduler::StaticGetTimer() {
     return timer;
 }
 
-void Scheduler::NewProcessThread()
+Processer* Scheduler::NewProcessThread()
 {
-    auto p = new Processer(this, processers_.size());
+    std::size_t pcount = processers_.size();
+    for (std::size_t i = 0; i < pcount; ++i) {
+        auto p = processers_[i];
+        if (p->dormant_ && p->dormant_.exchange(false)) {
+            DebugPrint(dbg_scheduler, "---> Revive Processer(%d)", p->id_);
+            p->active_ = true;
+            StartProcessThread(p);
+            return p;
+        }
+    }
+
+    auto p = new Processer(this, pcount);
     DebugPrint(dbg_scheduler, "---> Create Processer(%d)", p->id_);
+    StartProcessThread(p);
+    processers_.push_back(p);
+    return p;
+}
+
+void Scheduler::StartProcessThread(Processer* p)
+{
     std::thread t([this, p]{
             DebugPrint(dbg_thread, "Start process(sched=%p) thread id: %lu", (void*)this, NativeThreadID());
             p->Process();
             });
     t.detach();
-    processers_.push_back(p);
+}
+
+void Scheduler::RetireIdleProcessers(std::size_t liveCount)
+{
+    int64_t timeout = CoroutineOptions::getInstance().processer_idle_timeout_us;
+    if (!timeout)
+        return ;
+
+    // 只回收因阻塞而扩展出来的P, 从后往前回收
+    int64_t now = Processer::NowMicrosecond();
+    for (std::size_t i = processers_.size(); i > (std::size_t)minThreadNumber_ && (int)liveCount > minThreadNumber_; --i) {
+        auto p = processers_[i - 1];
+        if (p->dormant_ || p->retiring_ || !p->IsWaiting())
+            continue;
+
+        if (now - p->idleSinceTick_ < timeout)
+            continue;
+
+        DebugPrint(dbg_scheduler, "Retire idle processer(%d)", p->id_);
+        p->retiring_ = true;
+        p->NotifyCondition();
+        --liveCount;
+    }
+}
+
+// 按紧急程度从高到低稳定排序: 有截止时间的协程在前, 其余按优先级
+static void SortByUrgency(SList<Task> & tasks)
+{
+    SList<Task> levels[prio_count + 1];
+    while (Task* tk = tasks.pop_front()) {
+        SList<Task> one(tk, tk, 1);
+        levels[tk->HasDeadline() ? 0 : tk->priority_ + 1].append(std::move(one));
+    }
+    for (int i = 0; i < prio_count + 1; ++i)
+        tasks.append(std::move(levels[i]));
+}
+
+SList<Task> Scheduler::CutByLoad(SList<Task> &tasks, std::size_t need)
+{
+    std::size_t n = 0, load = 0;
+    for(auto &tk : tasks)
+    {
+        load += Processer::TaskLoad(&tk);
+        if(load > need)
+           break;
+        ++n;
+    }
+    return tasks.cut(n);
 }
 
 void Scheduler::DispatchBlocks(Scheduler::BlockMap &blockings,Scheduler::ActiveMap &actives)
@@ -216,10 +375,15 @@ void Scheduler::DispatchBlocks(Scheduler::BlockMap &blockings,Scheduler::ActiveM
     
     if(tasks.empty())
        return;
+
+    //紧急的协程排在前面, 优先分给负载最低的p
+    SortByUrgency(tasks);
    
     ActiveMap newActives;
-    //总协程数
-    std::size_t totalTasks = tasks.size();
+    //总负载
+    std::size_t totalTasks = 0;
+    for (auto &tk : tasks)
+        totalTasks += Processer::TaskLoad(&tk);
     //需要平分协程p的数量
     std::size_t LowerNum = 0;
     //平分的协程数
@@ -247,20 +411,20 @@ void Scheduler::DispatchBlocks(Scheduler::BlockMap &blockings,Scheduler::ActiveM
     
     for(auto it = actives.begin(); it != LowerP; ++it)
     {
-        SList<Task> in = tasks.cut(avg - it->first);
+        SList<Task> in = CutByLoad(tasks, avg - it->first);
         
         if(in.empty())
           break;
 
         auto p = processers_[it->second];
 
-        p->AddTask(std::move(in));
+        p->AddStolenTasks(std::move(in));
     }
     //还剩下task就全都给最小的p
     if(!tasks.empty())
     {
         auto p = processers_[actives.begin()->second];
-        p->AddTask(std::move(tasks));
+        p->AddStolenTasks(std::move(tasks));
     }
 
     
@@ -273,7 +437,8 @@ void Scheduler::LoadBalance(Scheduler::ActiveMap &actives,std::size_t activeTask
      if(actives.begin()->first > avg * CoroutineOptions::getInstance().load_balance_rate)
         return;
      
-     SList<Task> tasks;
+     //按被偷的p所在的NUMA节点分组, 优先在同一节点内迁移协程
+     std::map<int, SList<Task>> tasks;
      for(auto it = actives.rbegin(); it != actives.rend(); ++it)
      {
           
@@ -282,36 +447,104 @@ void Scheduler::LoadBalance(Scheduler::ActiveMap &actives,std::size_t activeTask
 
           auto p = processers_[it->second];
 
-          SList<Task> in = p->Steal(it->first - avg); 
+          //按这个P上协程的平均负载换算成要偷的协程数, 不足一个协程的负载不偷
+          std::size_t n = (it->first - avg) / p->LoadUnit();
+          if(n == 0)
+             continue;
+
+          SList<Task> in = p->Steal(n); 
 
-          tasks.append(std::move(in));
+          tasks[p->numaNode_].append(std::move(in));
      }
 
-     if(tasks.empty())
-        return;
-     
      for(auto &kv : actives)
      {
          if(kv.first >= avg)
             break;
          auto p = processers_[kv.second];
 
-         auto in = tasks.cut(avg - kv.first);
-             
-         p->AddTask(std::move(in));
+         std::size_t need = avg - kv.first;
+         SList<Task> in = CutByLoad(tasks[p->numaNode_], need);
+         std::size_t got = 0;
+         for(auto &tk : in)
+             got += Processer::TaskLoad(&tk);
+         for(auto &node : tasks)
+         {
+             if(got >= need)
+                break;
+             SList<Task> more = CutByLoad(node.second, need - got);
+             for(auto &tk : more)
+                 got += Processer::TaskLoad(&tk);
+             in.append(std::move(more));
+         }
+
+         if(!in.empty())
+            p->AddStolenTasks(std::move(in));
      }
      //如果还剩下task,全都给最小的p
-     if(!tasks.empty())
+     SList<Task> rest;
+     for(auto &node : tasks)
+        rest.append(std::move(node.second));
+     if(!rest.empty())
      {
          auto p = processers_[actives.begin()->second];
-         p->AddTask(std::move(tasks));
+         p->AddStolenTasks(std::move(rest));
      }
 }
+void Scheduler::ParkDispatcher(std::size_t liveCount)
+{
+    std::unique_lock<std::mutex> lock(dispatchMtx_);
+    dispatcherParked_ = true;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    // 设置休眠标记后再检查一次, 与NotifyDispatcher配对, 防止丢失唤醒
+    if (stop_ || !IsAllProcesserIdle()) {
+        dispatcherParked_ = false;
+        return ;
+    }
+
+    DebugPrint(dbg_scheduler, "Park DispatcherThread");
+    auto pred = [this]{ return !dispatcherParked_ || stop_; };
+
+    // 有多余的P时需要按时醒来回收
+    int64_t timeout = CoroutineOptions::getInstance().processer_idle_timeout_us;
+    if ((int)liveCount > minThreadNumber_ && timeout)
+        dispatchCv_.wait_for(lock, std::chrono::microseconds(timeout), pred);
+    else
+        dispatchCv_.wait(lock, pred);
+
+    dispatcherParked_ = false;
+}
+
+bool Scheduler::IsAllProcesserIdle()
+{
+    std::size_t pcount = processers_.size();
+    for (std::size_t i = 0; i < pcount; i++) {
+        auto p = processers_[i];
+        if (p->dormant_)
+            continue;
+
+        if (!p->IsWaiting() || p->RunnableSize())
+            return false;
+    }
+    return true;
+}
+
+void Scheduler::NotifyDispatcher()
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (LIKELY(!dispatcherParked_))
+        return ;
+
+    std::unique_lock<std::mutex> lock(dispatchMtx_);
+    dispatcherParked_ = false;
+    dispatchCv_.notify_one();
+}
+
 void Scheduler::DispatcherThread()
 {
     DebugPrint(dbg_scheduler, "---> Start DispatcherThread");
     while (!stop_) {
-        // TODO: 用condition_variable降低cpu使用率
         std::this_thread::sleep_for(std::chrono::microseconds(CoroutineOptions::getInstance().dispatcher_thread_cycle_us));
  
         // 1.收集负载值, 收集阻塞状态, 打阻塞标记, 唤醒处于等待状态但是有任务的P
@@ -321,8 +554,17 @@ void Scheduler::DispatcherThread()
         BlockMap blockings;
 
         int isActiveCount = 0;
+        std::size_t liveCount = 0;
+        std::size_t idleCount = 0;
         for (std::size_t i = 0; i < pcount; i++) {
             auto p = processers_[i];
+            if (p->dormant_)
+                continue;
+            ++liveCount;
+
+            if (p->IsWaiting())
+                ++idleCount;
+
             //等待中的p不能算阻塞,无法加入新协程导致p饿死
             if (!p->IsWaiting() && p->IsBlocking()) {
                 blockings[i] = p->RunnableSize();
@@ -343,7 +585,11 @@ void Scheduler::DispatcherThread()
         std::size_t activeTasks = 0;
         for (std::size_t i = 0; i < pcount; i++) {
             auto p = processers_[i];
-            std::size_t loadaverage = p->RunnableSize();
+            if (p->dormant_)
+                continue;
+
+            p->SampleCpuTime();
+            std::size_t loadaverage = p->Load();
             totalLoadaverage += loadaverage;
 
             if (!p->active_) {
@@ -358,7 +604,7 @@ void Scheduler::DispatcherThread()
 
             if (p->active_) {
                 actives.insert(ActiveMap::value_type{loadaverage, i});
-                activeTasks += p->RunnableSize();
+                activeTasks += loadaverage;
                 p->Mark();
             }
 
@@ -367,13 +613,23 @@ void Scheduler::DispatcherThread()
             }
         }
 
-        if (actives.empty() && (int)pcount < maxThreadNumber_) {
+        int64_t now = Processer::NowMicrosecond();
+        if (actives.empty() && (int)liveCount < maxThreadNumber_ &&
+                now - lastSpawnTick_ >= CoroutineOptions::getInstance().processer_spawn_interval_us) {
             // 全部阻塞, 并且还有协程待执行, 起新线程
-            NewProcessThread();
-            actives.insert(ActiveMap::value_type{0, pcount});
-            ++pcount;
+            lastSpawnTick_ = now;
+            Processer* p = NewProcessThread();
+            actives.insert(ActiveMap::value_type{0, (idx_t)p->id_});
+            ++liveCount;
         }
 
+        RetireIdleProcessers(liveCount);
+
+        // 没有任何待执行的协程, 休眠到有P被唤醒为止
+        if (idleCount == liveCount && totalLoadaverage == 0) {
+            ParkDispatcher(liveCount);
+            continue;
+        }
         
         // 全部阻塞并且不能起新线程, 无需调度, 等待即可
         if (actives.empty())
@@ -395,21 +651,80 @@ void Scheduler::AddTask(Task* tk)
         return ;
     }
 
-    proc = Processer::GetCurrentProcesser();
-    if (proc && proc->active_ && proc->GetScheduler() == this) {
-        proc->AddTask(tk);
-        return ;
+    SelectProcesser()->AddTask(tk);
+}
+
+Processer* Scheduler::PinnedProcesser(int idx)
+{
+    std::size_t pcount = processers_.size();
+    if ((std::size_t)idx >= pcount) {
+        DebugPrint(dbg_scheduler, "co_processer(%d) out of range, only %d processers. use the last one.",
+                idx, (int)pcount);
+        idx = (int)pcount - 1;
     }
+    return processers_[idx];
+}
 
+Processer* Scheduler::SelectProcesser()
+{
+    auto proc = Processer::GetCurrentProcesser();
+    if (proc && proc->active_ && proc->GetScheduler() == this)
+        return proc;
+
+    // 不在本调度器的协程中(例如accept线程、AsyncCoroutinePool):
+    // 以最近激活的P为首选, 再随机取另一个激活的P, 只有后者待执行协程严格更少时才选它(power of two choices).
+    // 负载相同时保持和以前一样投递到同一个P上, 连续创建的协程不会无故分散到不同线程.
+    // 只读取计数器, 不加锁; 阻塞检测和后续的负载均衡仍然由dispatcher线程负责.
     std::size_t pcount = processers_.size();
-    std::size_t idx = lastActive_;
+    Processer* first = processers_[lastActive_ % pcount];
+    if (!first->active_)
+        first = RandomActiveProcesser(pcount, nullptr);
+    if (!first)
+        return processers_[lastActive_ % pcount];
+
+    Processer* second = RandomActiveProcesser(pcount, first);
+    if (second && second->RunnableSizeUnsafe() < first->RunnableSizeUnsafe())
+        return second;
+    return first;
+}
+
+Processer* Scheduler::RandomActiveProcesser(std::size_t pcount, Processer* exclude)
+{
+    static thread_local uint32_t seed = ((uint32_t)NativeThreadID() * 2654435761u) | 1;
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+
+    // 随机位置不可用时向后找第一个激活的P
+    std::size_t idx = seed % pcount;
     for (std::size_t i = 0; i < pcount; ++i, ++idx) {
-        idx = idx % pcount;
-        proc = processers_[idx];
-        if (proc && proc->active_)
-            break;
+        Processer* proc = processers_[idx % pcount];
+        if (proc && proc != exclude && proc->active_)
+            return proc;
+    }
+    return nullptr;
+}
+
+Processer* Scheduler::SelectIdleProcesser(Processer* exclude)
+{
+    Processer* best = nullptr;
+    std::size_t bestLoad = 0;
+    bool bestParked = true;
+    std::size_t pcount = processers_.size();
+    for (std::size_t i = 0; i < pcount; ++i) {
+        Processer* p = processers_[i];
+        if (p == exclude || !p->active_ || p->dormant_ || p->runningTask_)
+            continue;
+
+        std::size_t load = p->RunnableSizeUnsafe();
+        bool parked = p->IsWaiting();
+        if (!best || parked < bestParked || (parked == bestParked && load < bestLoad)) {
+            best = p;
+            bestLoad = load;
+            bestParked = parked;
+        }
     }
-    proc->AddTask(tk);
+    return best;
 }
 
 uint32_t Scheduler::TaskCount()
@@ -417,6 +732,16 @@ uint32_t Scheduler::TaskCount()
     return taskCount_;
 }
 
+uint32_t Scheduler::ProcesserCount()
+{
+    uint32_t n = 0;
+    std::size_t pcount = processers_.size();
+    for (std::size_t i = 0; i < pcount; ++i)
+        if (!processers_[i]->dormant_)
+            ++n;
+    return n;
+}
+
 uint64_t Scheduler::GetCurrentTaskID()
 {
     Task* tk = Processer::GetCurrentTask();
@@ -429,6 +754,29 @@ uint64_t Scheduler::GetCurrentTaskYieldCount()
     return tk ? tk->yieldCount_ : 0;
 }
 
+uint64_t Scheduler::ExpiredDeadlineCount()
+{
+    uint64_t n = 0;
+    std::size_t pcount = processers_.size();
+    for (std::size_t i = 0; i < pcount; ++i)
+        n += processers_[i]->expiredDeadlineCount_;
+    return n;
+}
+
+SchedulerStats Scheduler::GetStats()
+{
+    SchedulerStats stats;
+    std::size_t pcount = processers_.size();
+    stats.processers_.resize(pcount);
+    for (std::size_t i = 0; i < pcount; ++i) {
+        ProcesserStats & ps = stats.processers_[i];
+        ps = processers_[i]->stats_;
+        ps.switches_ = processers_[i]->switchCount_;
+        stats.total_.Merge(ps);
+    }
+    return stats;
+}
+
 void Scheduler::SetCurrentTaskDebugInfo(std::string const& info)
 {
     Task* tk = Processer::GetCurrentTask();
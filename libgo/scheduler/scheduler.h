@@ -7,14 +7,23 @@
 #include "../debug/listener.h"
 #include "processer.h"
 #include <mutex>
+#include <atomic>
+#include <condition_variable>
 
 namespace co {
 
 struct TaskOpt
 {
+    // 绑定P: 协程只在加入的P上执行, 不会被work stealing偷走
     bool affinity_ = false;
+    uint8_t priority_ = prio_normal;
+    FastSteadyClock::time_point deadline_{};
+    // 指定加入的P的下标(超出当前P数量时取模), 隐含affinity_
+    int processer_ = -1;
     int lineno_ = 0;
     std::size_t stack_size_ = 0;
+    // 共享栈模式, 隐含affinity_, 此时stack_size_无效(栈大小上限为shared_stack_size)
+    bool sharedStack_ = false;
     const char* file_ = nullptr;
 };
 
@@ -31,7 +40,15 @@ public:
     static Scheduler* Create();
 
     // 创建一个协程
-    void CreateTask(TaskF const& fn, TaskOpt const& opt);
+    void CreateTask(TaskF && fn, TaskOpt const& opt);
+
+    // 批量创建协程
+    // 一次性分配ID, 按P分组后以链表整体加入, 每个P只加一次锁、唤醒一次.
+    void CreateTasks(std::vector<TaskF> && fns, TaskOpt const& opt);
+
+    // 投递一个轻量任务(go_light): 不分配协程栈, 在P上与其他轻量任务共用一个协程依次执行.
+    // 适合不会阻塞的短小任务. 任务阻塞时会升级为普通协程, 不影响同一P上后续的轻量任务.
+    void Post(TaskF && fn);
 
     // 当前是否处于协程中
     bool IsCoroutine();
@@ -59,12 +76,22 @@ public:
     // 当前调度器中的协程数量
     uint32_t TaskCount();
 
+    // 当前运行中(未休眠)的调度线程数量
+    uint32_t ProcesserCount();
+
     // 当前协程ID, ID从1开始（不在协程中则返回0）
     uint64_t GetCurrentTaskID();
 
     // 当前协程切换的次数
     uint64_t GetCurrentTaskYieldCount();
 
+    // 超过截止时间才开始执行的协程数量(co_deadline)
+    uint64_t ExpiredDeadlineCount();
+
+    // 调度统计的快照: 切换次数、负载均衡迁移的协程数、本地/跨线程唤醒次数、挂起次数,
+    // 排队时长和时间片长度的直方图. 需要开启enable_coro_stat, 否则除切换次数外都为0.
+    SchedulerStats GetStats();
+
     // 设置当前协程调试信息, 打印调试信息时将回显
     void SetCurrentTaskDebugInfo(std::string const& info);
 
@@ -91,19 +118,54 @@ private:
 
     static void DeleteTask(RefObject* tk, void* arg);
 
+    // 创建协程对象, 不加入任何P. 调用者负责分配ID和增加taskCount_
+    Task* NewTask(TaskF && fn, TaskOpt const& opt, uint64_t id);
+
     // 将一个协程加入可执行队列中
     void AddTask(Task* tk);
 
+    // 选择一个接受新协程的P
+    Processer* SelectProcesser();
+
+    // co_processer指定的P, 下标超出当前P的数量时使用最后一个P
+    Processer* PinnedProcesser(int idx);
+
+    // 随机选择一个exclude以外的激活的P, 没有时返回nullptr
+    Processer* RandomActiveProcesser(std::size_t pcount, Processer* exclude);
+
+    // 选择负载最低的空闲P(没有正在运行的协程), 优先选择还没挂起的. 没有时返回nullptr
+    Processer* SelectIdleProcesser(Processer* exclude);
+
+    // 为P创建执行轻量任务的协程, 不加入任何P
+    Task* CreateLightRunner(Processer* p);
+
     // dispatcher线程函数
     // 1.根据待执行协程计算负载, 将高负载的P中的协程steal一些给空载的P
     // 2.侦测到阻塞的P(单个协程运行时间超过阀值), 将P中的其他协程steal给其他P
     void DispatcherThread();
 
-    void NewProcessThread();
+    // 启动一个调度线程: 优先复用休眠的P, 没有时创建新的P
+    Processer* NewProcessThread();
+
+    void StartProcessThread(Processer* p);
+
+    // 回收空闲超时的多余P
+    void RetireIdleProcessers(std::size_t liveCount);
 
     void DispatchBlocks(BlockMap &blockings,ActiveMap &actives);
 
     void LoadBalance(ActiveMap &actives,std::size_t activeTasks);
+
+    // 从tasks头部切出总负载不超过need的协程
+    static SList<Task> CutByLoad(SList<Task> &tasks, std::size_t need);
+
+    // 所有P都空闲时, dispatcher线程休眠, 直到有P被唤醒
+    void ParkDispatcher(std::size_t liveCount);
+
+    bool IsAllProcesserIdle();
+
+    // P从空闲中被唤醒时调用, 唤醒休眠中的dispatcher线程
+    void NotifyDispatcher();
     
     TimerType & StaticGetTimer();
 
@@ -121,8 +183,15 @@ private:
     int minThreadNumber_ = 1;
     int maxThreadNumber_ = 1;
 
+    // 上次扩展调度线程的时间戳(Dispatch线程专用)
+    int64_t lastSpawnTick_ = 0;
+
     std::thread dispatchThread_;
 
+    std::mutex dispatchMtx_;
+    std::condition_variable dispatchCv_;
+    std::atomic_bool dispatcherParked_{false};
+
     std::mutex stopMtx_;
 
     bool stop_ = false;
@@ -2,12 +2,17 @@
 #include "../common/config.h"
 #include <iostream>
 #include <string.h>
+#include <stdlib.h>
+#if defined(LIBGO_SYS_Windows)
+#include <malloc.h>
+#endif
 #include <string>
 #include <algorithm>
 #include "../debug/listener.h"
 #include "../scheduler/scheduler.h"
 #include "../scheduler/ref.h"
 #include "../routine_sync_libgo/libgo_switcher.h"
+#include "../common/hugepage_arena.h"
 
 namespace co
 {
@@ -80,11 +85,23 @@ void FCONTEXT_CALL Task::StaticRun(intptr_t vp)
     tk->Run();
 }
 
-Task::Task(TaskF const& fn, std::size_t stack_size)
-    : ctx_(&Task::StaticRun, (intptr_t)this, stack_size), fn_(fn)
+Task::Task(TaskF && fn, std::size_t stack_size)
+    : ctx_(&Task::StaticRun, (intptr_t)this, stack_size), fn_(std::move(fn))
 {
 //    DebugPrint(dbg_task, "task(%s) construct. this=%p", DebugInfo(), this);
-    extern_switcher_ = (void*)(new LibgoSwitcher);
+    InitSwitcher();
+}
+
+Task::Task(TaskF && fn, SharedStackTag tag)
+    : ctx_(&Task::StaticRun, (intptr_t)this, tag), fn_(std::move(fn))
+{
+    InitSwitcher();
+}
+
+void Task::InitSwitcher()
+{
+    static_assert(sizeof(LibgoSwitcher) <= sizeof(switcherStorage_), "switcherStorage_ too small");
+    extern_switcher_ = (void*)(new (&switcherStorage_) LibgoSwitcher(ctx_.IsSharedStack()));
 }
 
 Task::~Task()
@@ -93,10 +110,52 @@ Task::~Task()
     assert(!this->prev);
     assert(!this->next);
 //    DebugPrint(dbg_task, "task(%s) destruct. this=%p", DebugInfo(), this);
-    delete (LibgoSwitcher*)extern_switcher_;
+    if (ctx_.IsStackSampled())
+        StackArena::getInstance().RecordUsage(TaskRefLocation(this), ctx_.StackHighWater());
+
+    ((LibgoSwitcher*)extern_switcher_)->~LibgoSwitcher();
     extern_switcher_ = nullptr;
 }
 
+// 第一次创建Task时确定, 保证分配和释放使用同一种方式
+static bool UseHugePageArena()
+{
+    static const bool use = CoroutineOptions::getInstance().task_hugepage_arena;
+    return use;
+}
+
+void* Task::operator new(std::size_t size)
+{
+    if (UseHugePageArena()) {
+        void* p = HugePageArena::Malloc(size);
+        if (!p) throw std::bad_alloc();
+        return p;
+    }
+
+    void* p = nullptr;
+#if defined(LIBGO_SYS_Windows)
+    p = _aligned_malloc(size, alignof(Task));
+#else
+    if (posix_memalign(&p, alignof(Task), size) != 0)
+        p = nullptr;
+#endif
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void Task::operator delete(void* ptr)
+{
+    if (UseHugePageArena())
+        HugePageArena::Free(ptr);
+    else {
+#if defined(LIBGO_SYS_Windows)
+        _aligned_free(ptr);
+#else
+        free(ptr);
+#endif
+    }
+}
+
 const char* Task::DebugInfo()
 {
     if (reinterpret_cast<void*>(this) == nullptr) return "nil";
@@ -2,6 +2,8 @@
 #include "../common/config.h"
 #include "../common/ts_queue.h"
 #include "../common/anys.h"
+#include "../common/clock.h"
+#include "../common/small_function.h"
 #include "../context/context.h"
 #include "../debug/debugger.h"
 #include "../routine_sync/timer.h"
@@ -9,7 +11,7 @@
 namespace co
 {
 
-enum class TaskState
+enum class TaskState : uint8_t
 {
     runnable,
     block,
@@ -18,7 +20,18 @@ enum class TaskState
 
 const char* GetTaskStateName(TaskState state);
 
-typedef std::function<void()> TaskF;
+// 协程优先级, 数值越小越优先执行
+// 同一个P中, 高优先级的runnable协程总是先于低优先级的协程被调度(低优先级的会按老化规则偶尔插队, 防止饿死)
+enum
+{
+    prio_high = 0,
+    prio_normal,
+    prio_low,
+    prio_count,
+};
+
+// 协程函数: 只能移动, 不大于64字节的捕获直接存放在Task对象内, 无需额外分配内存
+typedef SmallFunction<64> TaskF;
 
 struct TaskGroupKey {};
 typedef Anys<TaskGroupKey> TaskAnys;
@@ -28,30 +41,66 @@ class Processer;
 struct Task
     : public TSQueueHook, public SharedRefObject, public CoDebugger::DebuggerBase<Task>
 {
-    TaskState state_ = TaskState::runnable;
+    // Task按cache line对齐分配(见operator new). 开头的cache line被队列节点和引用计数占满,
+    // 随后的56字节放温数据, 把热数据对齐到一个完整的cache line中.
+
+    // ------ 温数据: 挂起、唤醒、让出时访问 ------
     uint64_t id_;
+    atomic_t<uint64_t> suspendId_ {0};
+    uint64_t yieldCount_ = 0;
+
+    // 截止时间(EDF调度), 默认值表示没有截止时间
+    FastSteadyClock::time_point deadline_{};
+
+    // 执行轻量任务(go_light)的协程所属的P, 普通协程为nullptr
+    Processer* lightOwner_ = nullptr;
+
+    std::exception_ptr eptr_;           // 保存exception的指针
+    ::libgo::RoutineSyncTimer* schedTimer_ = nullptr;
+
+    // ------ 热数据: 每次调度切换都会访问, 恰好占满一个cache line ------
+    alignas(64) TaskState state_ = TaskState::runnable;
+    uint8_t priority_ = prio_normal;
+    bool deadlineExpired_ = false;
+    bool isInTimer_ {false};
+
+    // 指数衰减的平均时间片长度(FastSteadyClock::ticks计数, 超出uint32时饱和), 用于负载均衡.
+    // 放在对齐空隙中, 不增加Task的大小
+    uint32_t sliceTicks_ = 0;
     Processer* proc_ = nullptr;
     Context ctx_;
+
     TaskF fn_;
-    std::exception_ptr eptr_;           // 保存exception的指针
+
+    // ------ 冷数据 ------
     TaskAnys anys_;
-    void* extern_switcher_ {nullptr};
 
-    ::libgo::RoutineSyncTimer::TimerId suspendTimerId_;
-    ::libgo::RoutineSyncTimer* schedTimer_ = nullptr;
-    bool isInTimer_ {false};
+    // 带超时的挂起使用的定时器节点, 首次使用时才分配
+    std::unique_ptr<::libgo::RoutineSyncTimer::TimerId> suspendTimerId_;
 
-    uint64_t yieldCount_ = 0;
+    // routine_sync的切换器(LibgoSwitcher), 直接构造在switcherStorage_中
+    void* extern_switcher_ {nullptr};
+    typename std::aligned_storage<48, alignof(void*)>::type switcherStorage_;
 
-    atomic_t<uint64_t> suspendId_ {0};
+    Task(TaskF && fn, std::size_t stack_size);
+
+    // 共享栈模式: 在P的共享栈上运行, 换出后只保存实际使用的那部分栈
+    Task(TaskF && fn, SharedStackTag);
 
-    Task(TaskF const& fn, std::size_t stack_size);
     ~Task();
 
+    // 按cache line对齐分配. 开启task_hugepage_arena时从大页内存池中分配(内存块本身按64字节对齐)
+    static void* operator new(std::size_t size);
+    static void operator delete(void* ptr);
+
     ALWAYS_INLINE void SwapIn()
     {
         ctx_.SwapIn();
     }
+    ALWAYS_INLINE void SwapIn(SharedStack & ss)
+    {
+        ctx_.SwapIn(ss);
+    }
     //ALWAYS_INLINE void SwapTo(Task* other)
     //{
     //    ctx_.SwapTo(other->ctx_);
@@ -61,6 +110,18 @@ struct Task
         ctx_.SwapOut();
     }
 
+    ALWAYS_INLINE ::libgo::RoutineSyncTimer::TimerId & SuspendTimerId()
+    {
+        if (!suspendTimerId_)
+            suspendTimerId_.reset(new ::libgo::RoutineSyncTimer::TimerId);
+        return *suspendTimerId_;
+    }
+
+    ALWAYS_INLINE bool HasDeadline() const
+    {
+        return deadline_ != FastSteadyClock::time_point{};
+    }
+
     const char* DebugInfo();
 
 private:
@@ -68,6 +129,8 @@ private:
 
     static void FCONTEXT_CALL StaticRun(intptr_t vp);
 
+    void InitSwitcher();
+
     Task(Task const&) = delete;
     Task(Task &&) = delete;
     Task& operator=(Task const&) = delete;
@@ -6,6 +6,7 @@
 #include <atomic>
 #include <chrono>
 #include <iomanip>
+#include <vector>
 using namespace std;
 using namespace std::chrono;
 
@@ -31,11 +32,178 @@ void foo() {
     gTask->SwapOut();
 }
 
-int main()
+// 裸切换: 不经过Task, 对比boost.context的jump_fcontext和内联汇编的JumpFContext
+fcontext_t gMainCtx, gRawCtx;
+char gRawStack[64 * 1024];
+
+void FCONTEXT_CALL boostFoo(intptr_t) {
+    for (;;) libgo_jump_fcontext(&gRawCtx, gMainCtx, 0);
+}
+
+void FCONTEXT_CALL fastFoo(intptr_t) {
+    for (;;) co::JumpFContext(&gRawCtx, gMainCtx, 0);
+}
+
+void benchRawSwitch() {
+    O("---- raw switch: boost jump_fcontext ----");
+    gRawCtx = libgo_make_fcontext(gRawStack + sizeof(gRawStack), sizeof(gRawStack), &boostFoo);
+    {
+        Bench b;
+        b.add(cSwitch);
+        for (int j = 0; j < cSwitch / 2; ++j)
+            libgo_jump_fcontext(&gMainCtx, gRawCtx, 0);
+    }
+
+    O("---- raw switch: JumpFContext (fast=" << LIBGO_FAST_CONTEXT << ") ----");
+    gRawCtx = co::MakeFContext(gRawStack + sizeof(gRawStack), sizeof(gRawStack), &fastFoo);
+    {
+        Bench b;
+        b.add(cSwitch);
+        for (int j = 0; j < cSwitch / 2; ++j)
+            co::JumpFContext(&gMainCtx, gRawCtx, 0);
+    }
+}
+
+// 共享栈: 两个协程交替运行在同一块共享栈上, 每次切换都要换出/换入对方的栈数据
+const int cSharedSwitch = 10000000;
+co::Task *gShared[2] = {nullptr, nullptr};
+int gSharedDepth = 0;
+
+template <int Depth>
+void sharedFoo(int idx) {
+    volatile char buf[Depth];   // 模拟协程挂起时栈的实际使用量
+    buf[0] = 0;
+    for (int j = 0; j < cSharedSwitch / 2; ++j)
+        gShared[idx]->SwapOut();
+    gShared[idx]->state_ = co::TaskState::done;
+    gShared[idx]->SwapOut();
+}
+
+template <int Depth>
+void benchShared() {
+    O("---- shared stack, used " << Depth << " bytes ----");
+    co::SharedStack ss(128 * 1024);
+    uint32_t savedSize = 0;
+    gShared[0] = new co::Task([]{ sharedFoo<Depth>(0); }, co::SharedStackTag());
+    gShared[1] = new co::Task([]{ sharedFoo<Depth>(1); }, co::SharedStackTag());
+    {
+        Bench b;
+        b.add(cSharedSwitch);
+        while (gShared[0]->state_ != co::TaskState::done || gShared[1]->state_ != co::TaskState::done) {
+            for (int i = 0; i < 2; ++i)
+                if (gShared[i]->state_ != co::TaskState::done) {
+                    gShared[i]->SwapIn(ss);
+                    savedSize = std::max(savedSize, gShared[i ^ 1]->ctx_.SavedStackSize());
+                }
+        }
+    }
+    OUT(savedSize);
+    for (int i = 0; i < 2; ++i) {
+        gShared[i]->ctx_.ReleaseSharedStack(ss);
+        delete gShared[i];
+    }
+}
+
+// 海量协程轮流切换: 栈和Task对象分散在内存中时, 每次切换都可能TLB miss
+const int cRoundRobinTasks = 10000;
+const int cRoundRobinRounds = 1000;
+std::vector<co::Task*> gRoundRobin;
+
+void roundRobinFoo() {
+    co::Task* self = gRoundRobin[gRoundRobin.size() - 1];
+    volatile char buf[1024];
+    buf[0] = 0;
+    for (int j = 0; j < cRoundRobinRounds; ++j) {
+        buf[j % sizeof(buf)] = j;
+        self->SwapOut();
+    }
+    self->state_ = co::TaskState::done;
+    self->SwapOut();
+}
+
+void benchRoundRobin() {
+    O("---- round robin " << cRoundRobinTasks << " tasks ----");
+    for (int i = 0; i < cRoundRobinTasks; ++i) {
+        gRoundRobin.push_back(new co::Task(&roundRobinFoo, 16 * 1024));
+        gRoundRobin.back()->SwapIn();   // 先让每个协程跑起来并保存自己的Task指针
+    }
+    {
+        Bench b;
+        b.add((long)cRoundRobinTasks * cRoundRobinRounds);
+        for (int j = 0; j < cRoundRobinRounds; ++j)
+            for (co::Task* tk : gRoundRobin)
+                tk->SwapIn();
+    }
+    for (co::Task* tk : gRoundRobin)
+        delete tk;
+    gRoundRobin.clear();
+}
+
+// 调度器中的切换: 两个协程互相co_yield, 每次切换都要经过Processer和线程局部的调度器上下文
+const int cYield = 10000000;
+
+void benchSchedulerYield() {
+    O("---- scheduler yield ----");
+    co::Scheduler* sched = co::Scheduler::Create();
+    std::atomic<int> done{0};
+    for (int i = 0; i < 2; ++i)
+        go co_scheduler(sched) [&]{
+            for (int j = 0; j < cYield / 2; ++j)
+                co_yield;
+            ++done;
+        };
+    {
+        Bench b;
+        b.add(cYield);
+        std::thread([=]{ sched->Start(1, 1); }).detach();
+        while (done < 2) usleep(1000);
+    }
+
+    // hook函数的入口都要判断当前是否在协程中
+    O("---- hook check: Processer::GetCurrentTask ----");
+    std::atomic<long> found{0};
+    done = 0;
+    go co_scheduler(sched) [&]{
+        Bench b;
+        b.add(cSwitch);
+        long n = 0;
+        for (int j = 0; j < cSwitch; ++j) {
+            co::Task* volatile tk = co::Processer::GetCurrentTask();
+            n += !!tk;
+        }
+        found = n;
+        ++done;
+    };
+    while (done < 1) usleep(1000);
+    OUT(found);
+    sched->Stop();
+}
+
+// ./context hugepage : 协程栈和Task对象使用大页内存池
+int main(int argc, char** argv)
 {
+    if (argc > 1 && strcmp(argv[1], "hugepage") == 0) {
+        O("==== hugepage arena ====");
+        co_opt.task_hugepage_arena = true;
+        co_opt.stack_malloc_fn = &co::HugePageArena::Malloc;
+        co_opt.stack_free_fn = &co::HugePageArena::Free;
+    }
+
+    benchRawSwitch();
+
+    // 需要在手动创建Task之前运行, 协程的扩展字段(Anys)要在第一个Task创建前注册
+    benchSchedulerYield();
+
+    O("---- private stack ----");
     gTask = new co::Task(&foo, 128 * 1024);
     while (gTask->state_ != co::TaskState::done) {
         gTask->SwapIn();
     }
+
+    benchRoundRobin();
+
+    benchShared<64>();
+    benchShared<1024>();
+    benchShared<8192>();
     printf("Done\n");
 }
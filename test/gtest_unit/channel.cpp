@@ -8,6 +8,7 @@
 #define OPEN_ROUTINE_SYNC_DEBUG 1
 #include "coroutine.h"
 #include "gtest_exit.h"
+#include "pinfo.h"
 using namespace std::chrono;
 using namespace co;
 
@@ -366,6 +367,142 @@ TEST(Channel, capacityN_WR)
     }
 }
 
+// 拷贝构造可能抛出异常的类型, channel应该使用加锁的队列
+struct ThrowOnCopy
+{
+    static bool s_throw;
+    int v_;
+
+    ThrowOnCopy(int v = 0) : v_(v) {}
+    ThrowOnCopy(ThrowOnCopy const& o) : v_(o.v_) {
+        if (s_throw) throw std::runtime_error("copy");
+    }
+    ThrowOnCopy& operator=(ThrowOnCopy const&) = default;
+};
+bool ThrowOnCopy::s_throw = false;
+
+TEST(Channel, capacityN_ring)
+{
+    // 容量不是2的幂时也要严格按容量判满
+    {
+        co_chan<int> ch(3);
+        EXPECT_EQ(ch.size(), 0u);
+        for (int i = 0; i < 3; ++i) {
+            EXPECT_TRUE(ch.try_push(i));
+        }
+        EXPECT_FALSE(ch.try_push(3));
+        EXPECT_EQ(ch.size(), 3u);
+
+        GTimer t;
+        EXPECT_FALSE(ch.push_for(3, milliseconds(50)));
+        TIMER_CHECK(t, 50, DEFAULT_DEVIATION);
+
+        for (int i = 0; i < 3; ++i) {
+            int v = -1;
+            EXPECT_TRUE(ch.try_pop(v));
+            EXPECT_EQ(v, i);
+        }
+        int v = -1;
+        EXPECT_FALSE(ch.try_pop(v));
+        EXPECT_TRUE(ch.empty());
+
+        t.reset();
+        EXPECT_FALSE(ch.pop_for(v, milliseconds(50)));
+        TIMER_CHECK(t, 50, DEFAULT_DEVIATION);
+    }
+
+    // 槽位里剩余的对象随channel析构
+    {
+        std::shared_ptr<int> obj(new int(1));
+        {
+            co_chan<std::shared_ptr<int>> ch(4);
+            ch << obj << obj;
+            std::shared_ptr<int> v;
+            ch >> v;
+            EXPECT_EQ(obj.use_count(), 3);
+        }
+        EXPECT_EQ(obj.use_count(), 1);
+    }
+
+    // 线程和协程混合的多生产者多消费者, 关闭后消费者读完剩余数据再退出
+    {
+        const int producers = 8;
+        const int consumers = 8;
+        const int n = 20000;
+        co_chan<long> ch(16);
+        std::atomic_long acc {0}, check_acc {0}, count {0};
+
+        for (int j = 0; j < consumers; j++)
+            go [&] {
+                long v;
+                while (ch.pop(v)) {
+                    check_acc += v;
+                    ++count;
+                }
+            };
+
+        std::vector<std::thread> threads;
+        for (int j = 0; j < producers; j++)
+            threads.emplace_back([&]{
+                for (long i = 0; i < n; i++) {
+                    acc += i;
+                    ch << i;
+                }
+            });
+
+        for (auto & th : threads)
+            th.join();
+        ch.close();
+        WaitUntilNoTask();
+
+        EXPECT_EQ(count, producers * n);
+        EXPECT_EQ(acc, check_acc);
+        EXPECT_TRUE(ch.empty());
+        EXPECT_FALSE(ch.push(1));
+    }
+
+    // 大容量的channel不预分配槽位, 使用按需增长的deque
+    {
+        pinfo before;
+        co_chan<int> ch(1 << 24);
+        for (int i = 0; i < 1000; ++i) {
+            EXPECT_TRUE(ch.try_push(i));
+        }
+        EXPECT_EQ(ch.size(), 1000u);
+        pinfo after;
+        EXPECT_LT(after.rss - before.rss, 16u * 1024);
+
+        for (int i = 0; i < 1000; ++i) {
+            int v = -1;
+            EXPECT_TRUE(ch.try_pop(v));
+            EXPECT_EQ(v, i);
+        }
+        EXPECT_TRUE(ch.empty());
+    }
+
+    // 拷贝时抛出异常不影响channel后续的使用
+    {
+        static_assert(!libgo::ChannelImpl<ThrowOnCopy, std::deque<ThrowOnCopy>>::use_ring_t::value,
+                "throwing copy must use the locked queue");
+
+        co_chan<ThrowOnCopy> ch(2);
+        EXPECT_TRUE(ch.try_push(ThrowOnCopy(1)));
+        ThrowOnCopy::s_throw = true;
+        EXPECT_THROW(ch.try_push(ThrowOnCopy(2)), std::runtime_error);
+        ThrowOnCopy::s_throw = false;
+        EXPECT_EQ(ch.size(), 1u);
+
+        EXPECT_TRUE(ch.try_push(ThrowOnCopy(3)));
+        EXPECT_FALSE(ch.try_push(ThrowOnCopy(4)));
+        ThrowOnCopy v;
+        EXPECT_TRUE(ch.try_pop(v));
+        EXPECT_EQ(v.v_, 1);
+        EXPECT_TRUE(ch.try_pop(v));
+        EXPECT_EQ(v.v_, 3);
+        EXPECT_FALSE(ch.try_pop(v));
+    }
+}
+
 TEST(Channel, capacity0Try)
 {
     co_chan<int> ch;
@@ -403,10 +540,11 @@ TEST(Channel, capacity0Try)
         WaitUntilNoTask();
         EXPECT_EQ(i, 2);
 
+        // 检查的是同一个P上的执行顺序, 固定到同一个P, 避免新协程被分配到不同的线程上
         std::atomic<int> step{0};
         int before_push = 0, after_push = 0, before_pop = 0, after_pop = 0;
-        go [&]{ before_push = ++step; ch >> i; after_push = ++step; EXPECT_YIELD(1);};
-        go [&]{ SLEEP(50); before_pop = ++step; EXPECT_TRUE(ch.TryPush(3)); after_pop = ++step; EXPECT_YIELD(1);};
+        go co_processer(0) [&]{ before_push = ++step; ch >> i; after_push = ++step; EXPECT_YIELD(1);};
+        go co_processer(0) [&]{ SLEEP(50); before_pop = ++step; EXPECT_TRUE(ch.TryPush(3)); after_pop = ++step; EXPECT_YIELD(1);};
         WaitUntilNoTask();
         EXPECT_EQ(i, 3);
         EXPECT_EQ(before_push, 1);
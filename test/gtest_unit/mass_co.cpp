@@ -3,9 +3,13 @@
 #include <gtest/gtest.h>
 #include "coroutine.h"
 #include <chrono>
+#include <atomic>
 #include <fstream>
 #include <time.h>
 #include <stdlib.h>
+#include <cstddef>
+#include <string.h>
+#include <thread>
 #include "gtest_exit.h"
 #include "pinfo.h"
 using namespace std;
@@ -16,6 +20,18 @@ using ::testing::Values;
 
 bool is_show_memory = true;
 
+// LIBGO_HUGEPAGE=1 时协程栈和Task对象使用大页内存池, 用于和默认的malloc对比:
+//      LIBGO_HUGEPAGE=1 ./mass_co.t --gtest_filter=MassCoTest*
+static bool s_hugepage = []{
+    if (!getenv("LIBGO_HUGEPAGE"))
+        return false;
+    co_opt.task_hugepage_arena = true;
+    co_opt.hugepage_explicit = atoi(getenv("LIBGO_HUGEPAGE")) == 2;
+    co_opt.stack_malloc_fn = &HugePageArena::Malloc;
+    co_opt.stack_free_fn = &HugePageArena::Free;
+    return true;
+}();
+
 struct MassCo : public TestWithParam<int>
 {
     int n_;
@@ -67,6 +83,239 @@ TEST_P(MassCo, CnK)
     }
 }
 
+// 海量协程轮流切换, 栈和Task对象分散在内存中时TLB miss明显
+TEST_P(MassCo, SwitchCost)
+{
+    size_t n = n_;
+    const int rounds = 100;
+    for (size_t i = 0; i < n; ++i)
+        go co_stack(16 * 1024) []{
+            for (int j = 0; j < rounds; ++j)
+                co_yield;
+        };
+
+    auto start = std::chrono::steady_clock::now();
+    WaitUntilNoTask();
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    cout << n << " coroutines" << (s_hugepage ? " (hugepage arena)" : "")
+        << ", per switch: " << ns / (long)(n * rounds) << " ns" << endl;
+}
+
+#if defined(LIBGO_SYS_Linux)
+TEST(MassCoMemory, HugePageArena)
+{
+    // 小块内存从2MB对齐的块中切分, 释放后复用
+    void* a = HugePageArena::Malloc(sizeof(Task));
+    void* b = HugePageArena::Malloc(sizeof(Task));
+    EXPECT_EQ((std::size_t)a % 64, 0u);
+    EXPECT_EQ((std::size_t)a & ~(HugePageArena::kChunkSize - 1), (std::size_t)b & ~(HugePageArena::kChunkSize - 1));
+    HugePageArena::Free(b);
+    EXPECT_EQ(HugePageArena::Malloc(sizeof(Task)), b);
+
+    // 在其他线程释放, 还给原来的分片
+    std::thread([=]{ HugePageArena::Free(b); }).join();
+    EXPECT_EQ(HugePageArena::Malloc(sizeof(Task)), b);
+    HugePageArena::Free(a);
+    HugePageArena::Free(b);
+
+    // 一个块中放不下两个的内存(如默认1MB的栈)单独映射普通页, 不按2MB取整
+    uint64_t mapped = HugePageArena::MappedBytes();
+    void* stack = HugePageArena::Malloc(1024 * 1024);
+    EXPECT_EQ(HugePageArena::MappedBytes(), mapped + 1024 * 1024 + 4096);
+    void* big = HugePageArena::Malloc(3 * 1024 * 1024);
+    memset(big, 1, 3 * 1024 * 1024);
+    EXPECT_EQ(HugePageArena::MappedBytes(), mapped + 1024 * 1024 + 4096 + 3 * 1024 * 1024 + 4096);
+    HugePageArena::Free(big);
+    HugePageArena::Free(stack);
+    EXPECT_EQ(HugePageArena::MappedBytes(), mapped);
+
+    // 小于半个块的内存仍然从大页中切分
+    void* half = HugePageArena::Malloc(512 * 1024);
+    EXPECT_EQ(HugePageArena::MappedBytes() - mapped, (uint64_t)HugePageArena::kChunkSize);
+    HugePageArena::Free(half);
+
+    // 作为协程栈的分配函数
+    if (!s_hugepage) {
+        co_opt.stack_malloc_fn = &HugePageArena::Malloc;
+        co_opt.stack_free_fn = &HugePageArena::Free;
+    }
+    std::atomic<int> done{0};
+    for (int i = 0; i < 1000; ++i)
+        go co_stack(16 * 1024) [&]{ co_yield; ++done; };
+    WaitUntilNoTask();
+    EXPECT_EQ(done, 1000);
+    if (!s_hugepage) {
+        co_opt.stack_malloc_fn = &::std::malloc;
+        co_opt.stack_free_fn = &::std::free;
+    }
+}
+#endif
+
+// 空闲协程的内存占用: 紧凑的Task布局, 超时定时器节点和调试信息等冷数据按需分配
+TEST(MassCoMemory, TaskLayout)
+{
+    cout << "sizeof(Task) = " << sizeof(Task) << endl;
+#if __x86_64__ || __aarch64__
+    EXPECT_LE(sizeof(Task), 384u);
+#endif
+
+    // 调度切换时访问的热数据(状态、所属P、上下文)在同一个cache line中, 冷数据在协程函数之后.
+    // Task不是standard-layout, 用实际对象的地址计算偏移
+    Task* tk = new Task(TaskF([]{}), 128 * 1024);
+    char* base = (char*)tk;
+    std::size_t hotBegin = (char*)&tk->state_ - base;
+    std::size_t hotEnd = (char*)&tk->ctx_ + sizeof(tk->ctx_) - base;
+    EXPECT_EQ((std::size_t)base % 64, 0u);
+    EXPECT_EQ(hotBegin % 64, 0u);
+    EXPECT_LE(hotEnd - hotBegin, 64u);
+    EXPECT_GT((char*)&tk->anys_ - base, (char*)&tk->fn_ - base);
+    tk->DecrementRef();
+}
+
+struct LazyAnysGroup {};
+static int s_lazyConstructed = 0;
+struct LazyValue
+{
+    std::string s_;
+    LazyValue() { ++s_lazyConstructed; }
+};
+
+TEST(MassCoMemory, LazyAnys)
+{
+    typedef Anys<LazyAnysGroup> AnysT;
+    std::size_t hot = AnysT::Register<int>();
+    std::size_t lazy = AnysT::Register<LazyValue>();
+
+    {
+        // 未使用的key不构造, 不分配内存
+        AnysT anys;
+        EXPECT_EQ(anys.get<int>(hot), 0);
+        EXPECT_EQ(s_lazyConstructed, 0);
+
+        anys.get<LazyValue>(lazy).s_ = "abc";
+        EXPECT_EQ(s_lazyConstructed, 1);
+        EXPECT_EQ(anys.get<LazyValue>(lazy).s_, "abc");
+        EXPECT_EQ(s_lazyConstructed, 1);
+    }
+
+    AnysT other;
+    EXPECT_EQ(s_lazyConstructed, 1);
+}
+
+// 前面用例的协程在WaitUntilNoTask返回后才由P回收, 栈的释放可能和本用例的测量重叠.
+// 等物理内存读数稳定后再作为基准
+static pinfo StableRss()
+{
+    pinfo last;
+    for (int i = 0; i < 100; ++i) {
+        usleep(20 * 1000);
+        pinfo cur;
+        if (cur.rss == last.rss)
+            return cur;
+        last = cur;
+    }
+    return last;
+}
+
+TEST(MassCoMemory, IdleRss)
+{
+    Scheduler & sched = *Scheduler::Create();
+    const std::size_t n = 20000;
+    const std::size_t stack = 8192;
+
+    pinfo before = StableRss();
+    for (std::size_t i = 0; i < n; ++i)
+        go co_scheduler(sched) co_stack(stack) foo;
+    pinfo after;
+
+    // pinfo单位为KB. 每个协程的常驻内存: 栈顶被写入的一页 + Task对象.
+    // 大页内存池中的栈整页提交, 常驻内存是整个栈
+    std::size_t perCo = (after.rss - before.rss) * 1024 / n;
+    cout << n << " idle coroutines, RSS per coroutine: " << perCo << " bytes" << endl;
+    EXPECT_LT(perCo, (s_hugepage ? stack : 4096u) + 1024u);
+
+    std::thread([&]{ sched.Start(1, 1); }).detach();
+    WaitUntilNoTaskS(sched);
+}
+
+TEST(MassCoMemory, SharedStackIdleRss)
+{
+    Scheduler & sched = *Scheduler::Create();
+    const std::size_t n = 20000;
+    std::atomic<std::size_t> started{0};
+    std::thread([&]{ sched.Start(1, 1); }).detach();
+
+    pinfo before = StableRss();
+    for (std::size_t i = 0; i < n; ++i)
+        go co_scheduler(sched) co_shared_stack(true) [&]{
+            ++started;
+            co_sleep(1000);
+        };
+    while (started < n)
+        usleep(1000);
+    pinfo after;
+
+    // 所有协程都在sleep中, 每个协程只保留实际使用的那部分栈 + Task对象 + 定时器节点
+    std::size_t perCo = (after.rss - before.rss) * 1024 / n;
+    cout << n << " idle shared-stack coroutines, RSS per coroutine: " << perCo << " bytes" << endl;
+    EXPECT_LT(perCo, 2048u);
+
+    WaitUntilNoTaskS(sched);
+}
+
+// 使用约6KB栈
+static void touchStack(std::atomic<std::size_t> * started)
+{
+    volatile char buf[6 * 1024];
+    for (std::size_t i = 0; i < sizeof(buf); i += 512)
+        buf[i] = 1;
+    ++*started;
+    co_sleep(500);
+    buf[0] = 0;
+}
+
+#if defined(LIBGO_SYS_Linux)
+TEST(MassCoMemory, StackArena)
+{
+    co_opt.stack_arena = true;
+    co_opt.stack_usage_sample = 1;
+
+    Scheduler & sched = *Scheduler::Create();
+    const std::size_t n = 5000;
+    std::atomic<std::size_t> started{0};
+    std::thread([&]{ sched.Start(1, 1); }).detach();
+
+    // 1MB的栈上限, 实际只提交用到的页
+    pinfo before = StableRss();
+    int line = __LINE__; for (std::size_t i = 0; i < n; ++i) go co_scheduler(sched) co_stack(1024 * 1024) [&]{ touchStack(&started); };
+    while (started < n)
+        usleep(1000);
+    pinfo after;
+
+    std::size_t perCo = (after.rss - before.rss) * 1024 / n;
+    cout << n << " coroutines with 1MB arena stack, RSS per coroutine: " << perCo << " bytes" << endl;
+    EXPECT_LT(perCo, 16u * 1024);
+
+    WaitUntilNoTaskS(sched);
+    co_opt.stack_arena = false;
+    co_opt.stack_usage_sample = 0;
+
+    // 按创建位置统计的栈使用量
+    bool found = false;
+    for (auto & stat : StackArena::getInstance().GetUsageStats()) {
+        if (stat.location_.lineno_ != line)
+            continue;
+        found = true;
+        cout << "stack usage: samples=" << stat.samples_ << " avg=" << stat.AvgBytes()
+            << " max=" << stat.maxBytes_ << endl;
+        EXPECT_EQ(stat.samples_, n);
+        EXPECT_GE(stat.AvgBytes(), 6u * 1024);
+        EXPECT_LT(stat.maxBytes_, 16u * 1024);
+    }
+    EXPECT_TRUE(found);
+}
+#endif
+
 INSTANTIATE_TEST_CASE_P(
 	MassCoTest,
 	MassCo,
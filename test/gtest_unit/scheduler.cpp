@@ -1,4 +1,8 @@
 #include <iostream>
+#include <array>
+#include <memory>
+#include <algorithm>
+#include <string.h>
 #include <unistd.h>
 #include <gtest/gtest.h>
 #include "coroutine.h"
@@ -26,3 +30,593 @@ TEST(MultiScheduler, multiScheduler)
     WaitUntilNoTaskS(sched);
     EXPECT_EQ(val, 1);
 }
+
+TEST(Scheduler, priority)
+{
+    Scheduler & sched = *Scheduler::Create();
+    std::atomic<bool> highDone{false};
+    std::atomic<int> lowRounds{0};
+    int lowRoundsAtHighDone = -1;
+
+    for (int i = 0; i < 100; ++i)
+        go co_scheduler(sched) co_priority(co::prio_low) [&]{
+            while (!highDone) {
+                ++ lowRounds;
+                co_yield;
+            }
+        };
+
+    go co_scheduler(sched) co_priority(co::prio_high) [&]{
+        for (int i = 0; i < 10; ++i)
+            co_yield;
+        lowRoundsAtHighDone = lowRounds;
+
+        // 老化规则保证低优先级协程不会饿死
+        while (lowRounds == 0)
+            co_yield;
+        highDone = true;
+    };
+
+    std::thread([&]{ sched.Start(1, 1); }).detach();
+    WaitUntilNoTaskS(sched);
+    EXPECT_EQ(lowRoundsAtHighDone, 0);
+    EXPECT_GT(lowRounds, 0);
+}
+
+TEST(Scheduler, deadline)
+{
+    Scheduler & sched = *Scheduler::Create();
+    std::vector<int> order;
+    auto now = FastSteadyClock::now();
+
+    go co_scheduler(sched) [&]{ order.push_back(-1); };
+    for (int i = 5; i > 0; --i)
+        go co_scheduler(sched) co_deadline(now + std::chrono::seconds(i)) [&, i]{ order.push_back(i); };
+
+    // 已经过期的协程最先执行, 并被计数
+    go co_scheduler(sched) co_deadline(now - std::chrono::seconds(1)) [&]{ order.push_back(0); };
+
+    std::thread([&]{ sched.Start(1, 1); }).detach();
+    WaitUntilNoTaskS(sched);
+
+    std::vector<int> expect{0, 1, 2, 3, 4, 5, -1};
+    EXPECT_EQ(order, expect);
+    EXPECT_EQ(sched.ExpiredDeadlineCount(), 1u);
+}
+
+TEST(Scheduler, affinity)
+{
+    std::atomic<int> wrong{0};
+    int target = 1;
+
+    // 一个长时间占用P的协程, 让调度线程把这个P上的其他协程都steal走
+    go co_processer(target) [&]{
+        if (GetCurrentThreadID() != target) ++wrong;
+        auto start = std::chrono::steady_clock::now();
+        while (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(300)) ;
+    };
+
+    for (int i = 0; i < 100; ++i)
+        go co_processer(target) [&]{
+            for (int j = 0; j < 100; ++j) {
+                if (GetCurrentThreadID() != target) ++wrong;
+                co_yield;
+            }
+        };
+
+    WaitUntilNoTask();
+    EXPECT_EQ(wrong, 0);
+}
+
+TEST(Scheduler, affinityOutOfRange)
+{
+    Scheduler & sched = *Scheduler::Create();
+    std::thread([&]{ sched.Start(3, 3); }).detach();
+    while (sched.GetStats().processers_.size() < 3)
+        usleep(1000);
+
+    // 超出范围的下标使用最后一个P, 而不是取模
+    int id = -1;
+    go co_scheduler(sched) co_processer(4) [&]{ id = Processer::GetCurrentProcesser()->Id(); };
+    WaitUntilNoTaskS(sched);
+    EXPECT_EQ(id, 2);
+}
+
+#if defined(LIBGO_SYS_Linux)
+TEST(Scheduler, bindCpu)
+{
+    Scheduler & sched = *Scheduler::Create();
+    int cpu = -1;
+    go co_scheduler(sched) [&]{ cpu = sched_getcpu(); };
+
+    co_opt.processer_cpus = {0};
+    std::thread([&]{ sched.Start(1, 1); }).detach();
+    WaitUntilNoTaskS(sched);
+    co_opt.processer_cpus.clear();
+    EXPECT_EQ(cpu, 0);
+}
+#endif
+
+TEST(Scheduler, elastic)
+{
+    Scheduler & sched = *Scheduler::Create();
+    co_opt.processer_idle_timeout_us = 200 * 1000;
+    co_opt.processer_spawn_interval_us = 0;
+
+    // 阻塞住P的协程, 迫使调度器扩展线程
+    std::atomic<uint32_t> maxCount{0};
+    auto blocking = [&]{
+        auto start = std::chrono::steady_clock::now();
+        while (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(300)) ;
+        uint32_t n = sched.ProcesserCount();
+        uint32_t old = maxCount;
+        while (n > old && !maxCount.compare_exchange_weak(old, n)) ;
+    };
+
+    for (int i = 0; i < 4; ++i)
+        go co_scheduler(sched) blocking;
+
+    std::thread([&]{ sched.Start(1, 4); }).detach();
+    WaitUntilNoTaskS(sched);
+    EXPECT_GT(maxCount, 1u);
+
+    // 空闲超时后, 多余的线程退出
+    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+    EXPECT_EQ(sched.ProcesserCount(), 1u);
+
+    // 休眠的P可以被重新启动
+    maxCount = 0;
+    for (int i = 0; i < 2; ++i)
+        go co_scheduler(sched) blocking;
+    WaitUntilNoTaskS(sched);
+    EXPECT_GT(maxCount, 1u);
+
+    co_opt.processer_idle_timeout_us = 10 * 1000 * 1000;
+    co_opt.processer_spawn_interval_us = 10 * 1000;
+}
+
+TEST(Scheduler, spinIdle)
+{
+    Scheduler & sched = *Scheduler::Create();
+    co_opt.processer_spin_us = 500;
+
+    std::thread([&]{ sched.Start(2, 2); }).detach();
+
+    // 外部线程以较短的间隔投递协程, P应在自旋阶段接到任务
+    std::atomic<int> done{0};
+    for (int i = 0; i < 200; ++i) {
+        go co_scheduler(sched) [&]{ ++done; };
+        if (i % 10 == 0)
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+
+    WaitUntilNoTaskS(sched);
+    EXPECT_EQ(done, 200);
+    co_opt.processer_spin_us = 0;
+}
+
+TEST(Scheduler, spinBudget)
+{
+    // 稳定的5us空闲间隔应当得到足够覆盖它的自旋时长
+    IdleAverage avg;
+    for (int i = 0; i < 100; ++i)
+        avg.Add(5);
+    EXPECT_GE(avg.Us(), 4);
+    EXPECT_GE(avg.SpinBudget(500), 8);
+    EXPECT_LE(avg.SpinBudget(500), 12);
+
+    // 长时间空闲时不自旋
+    for (int i = 0; i < 100; ++i)
+        avg.Add(10000);
+    EXPECT_EQ(avg.SpinBudget(500), 0);
+}
+
+TEST(Scheduler, light)
+{
+    Scheduler & sched = *Scheduler::Create();
+    std::atomic<int> done{0};
+    std::atomic<int> afterBlock{0};
+
+    for (int i = 0; i < 1000; ++i)
+        go_light co_scheduler(sched) [&]{ ++done; };
+
+    // 阻塞的轻量任务会升级为普通协程, 不影响后续的轻量任务
+    go_light co_scheduler(sched) [&]{
+        co_sleep(200);
+        EXPECT_EQ(afterBlock, 100);
+        ++done;
+    };
+    for (int i = 0; i < 100; ++i)
+        go_light co_scheduler(sched) [&]{ ++afterBlock; };
+
+    std::thread([&]{ sched.Start(1, 1); }).detach();
+    WaitUntilNoTaskS(sched);
+    EXPECT_EQ(done, 1001);
+    EXPECT_EQ(afterBlock, 100);
+
+    // 在协程中投递
+    go co_scheduler(sched) [&]{ co::post([&]{ ++done; }); };
+    WaitUntilNoTaskS(sched);
+    EXPECT_EQ(done, 1002);
+}
+
+struct MoveOnlyFn
+{
+    std::unique_ptr<int> p_;
+    int * result_;
+    void operator()() { *result_ = *p_; }
+};
+
+TEST(Scheduler, moveOnlyTask)
+{
+    Scheduler & sched = *Scheduler::Create();
+
+    // 只能移动的可调用对象
+    int result = 0;
+    go co_scheduler(sched) MoveOnlyFn{std::unique_ptr<int>(new int(7)), &result};
+
+    // 超出内联存储的大捕获仍然可用
+    std::array<char, 256> big;
+    big.fill(1);
+    int sum = 0;
+    go co_scheduler(sched) [&sum, big]{ for (char c : big) sum += c; };
+
+    std::thread([&]{ sched.Start(1, 1); }).detach();
+    WaitUntilNoTaskS(sched);
+    EXPECT_EQ(result, 7);
+    EXPECT_EQ(sum, 256);
+
+    // 空的可调用对象和std::function行为一致
+    TaskF empty;
+    EXPECT_FALSE(empty);
+    EXPECT_THROW(empty(), std::bad_function_call);
+    EXPECT_FALSE(TaskF(std::function<void()>()));
+    EXPECT_FALSE(TaskF((void(*)())nullptr));
+    EXPECT_TRUE(TaskF(std::function<void()>([]{})));
+}
+
+TEST(Scheduler, batch)
+{
+    Scheduler & sched = *Scheduler::Create();
+    const std::size_t n = 10000;
+    std::vector<int> hits(n, 0);
+    go_batch(n) co_scheduler(sched) [&](std::size_t i){ ++hits[i]; };
+    EXPECT_EQ(sched.TaskCount(), n);
+
+    std::thread([&]{ sched.Start(4, 4); }).detach();
+    WaitUntilNoTaskS(sched);
+    EXPECT_EQ(std::count(hits.begin(), hits.end(), 1), (long)n);
+
+    // 在协程中批量创建, 优先分给当前P
+    std::atomic<int> done{0};
+    go co_scheduler(sched) [&]{
+        go_batch(100) [&](std::size_t){ ++done; };
+    };
+    WaitUntilNoTaskS(sched);
+    EXPECT_EQ(done, 100);
+
+    // mutable的可调用对象, 每个协程修改的是自己的拷贝
+    std::atomic<int> sum{0};
+    int state = 1;
+    go_batch(100) co_scheduler(sched) [state, &sum](std::size_t i) mutable {
+        state += (int)i;
+        sum += state;
+    };
+    WaitUntilNoTaskS(sched);
+    EXPECT_EQ(sum, 100 + 99 * 100 / 2);
+}
+
+TEST(Scheduler, sharedStack)
+{
+    Scheduler & sched = *Scheduler::Create();
+    const int n = 200;
+    std::atomic<int> ok{0};
+    std::atomic<int> migrated{0};
+    co_mutex mtx;
+    co_chan<int> ch;
+    int counter = 0;
+
+    for (int i = 0; i < n; ++i) {
+        go co_scheduler(sched) co_shared_stack(true) [&, i]{
+            // 栈上的数据和指向栈的指针在换出换入后保持不变
+            char buf[1024];
+            memset(buf, i & 0xff, sizeof(buf));
+            char* self = buf;
+            Processer* proc = Processer::GetCurrentProcesser();
+
+            co_yield;
+            co_sleep(1);
+            {
+                std::unique_lock<co_mutex> lock(mtx);
+                co_yield;
+                ++counter;
+            }
+
+            // 无缓冲channel: 对端直接读写等待方的数据
+            if (i % 2) ch << i;
+            else { int v; ch >> v; }
+
+            if (Processer::GetCurrentProcesser() != proc) ++migrated;
+            for (char c : buf)
+                if (c != (char)(i & 0xff)) return ;
+            if (self == buf) ++ok;
+        };
+    }
+
+    std::thread([&]{ sched.Start(4, 4); }).detach();
+    WaitUntilNoTaskS(sched);
+    EXPECT_EQ(ok, n);
+    EXPECT_EQ(migrated, 0);
+    EXPECT_EQ(counter, n);
+}
+
+TEST(Scheduler, runnext)
+{
+    Scheduler & sched = *Scheduler::Create();
+    std::vector<int> order;
+    co_chan<int> ch(1);
+
+    go co_scheduler(sched) [&]{ int v; ch >> v; order.push_back(0); };
+    go co_scheduler(sched) [&]{
+        ch << 1;
+        co_yield;
+    };
+    for (int i = 1; i <= 5; ++i)
+        go co_scheduler(sched) [&, i]{ order.push_back(i); };
+
+    std::thread([&]{ sched.Start(1, 1); }).detach();
+    WaitUntilNoTaskS(sched);
+
+    // 被唤醒的协程插队到先创建的协程之前
+    ASSERT_EQ(order.size(), 6u);
+    EXPECT_EQ(order[0], 0);
+
+    // 互相唤醒的一对协程不会饿死同一个P上的其他协程
+    Scheduler & sched3 = *Scheduler::Create();
+    co_chan<int> ping(1), pong(1);
+    std::atomic<bool> pingDone{false};
+    std::atomic<int> otherRounds{0};
+    int otherRoundsAtPingDone = -1;
+    go co_scheduler(sched3) [&]{
+        for (int i = 0; i < 1000; ++i) {
+            ping << i;
+            int v; pong >> v;
+        }
+        otherRoundsAtPingDone = otherRounds;
+        pingDone = true;
+    };
+    go co_scheduler(sched3) [&]{
+        for (int i = 0; i < 1000; ++i) {
+            int v; ping >> v;
+            pong << v;
+        }
+    };
+    go co_scheduler(sched3) [&]{
+        while (!pingDone) {
+            ++ otherRounds;
+            co_yield;
+        }
+    };
+
+    std::thread([&]{ sched3.Start(1, 1); }).detach();
+    WaitUntilNoTaskS(sched3);
+    EXPECT_GT(otherRoundsAtPingDone, 0);
+}
+
+TEST(Scheduler, wakePlacement)
+{
+    // 原P被一个不让出的协程占住时, 被唤醒的协程是否直接放到唤醒方的P上(唤醒方让出后立即执行)
+    // 关闭负载均衡, 避免dispatcher先把协程偷走
+    float balanceRate = co_opt.load_balance_rate;
+    co_opt.load_balance_rate = 0;
+    auto run = [](eWakePlacement placement) -> bool {
+        co_opt.wake_placement = placement;
+        Scheduler & sched = *Scheduler::Create();
+        std::thread([&]{ sched.Start(2, 2); }).detach();
+        while (sched.ProcesserCount() < 2)
+            usleep(1000);
+
+        co_chan<int> ch(1);
+        std::atomic<bool> woke{false};
+        bool wokeAfterYield = false;
+
+        go co_scheduler(sched) co_processer(0) [&]{
+            // 从P0上的协程创建的协程也在P0上, 并且没有绑定P
+            go co_scheduler(sched) [&]{
+                int v; ch >> v;
+                woke = true;
+            };
+            co_sleep(10);
+
+            auto start = FastSteadyClock::now();
+            while (!woke && FastSteadyClock::now() - start < std::chrono::milliseconds(80))
+                ;
+        };
+        go co_scheduler(sched) co_processer(1) [&]{
+            co_sleep(30);
+            ch << 1;
+            co_yield;
+            wokeAfterYield = woke;
+        };
+
+        WaitUntilNoTaskS(sched);
+        co_opt.wake_placement = eWakePlacement::original;
+        return wokeAfterYield;
+    };
+
+    EXPECT_FALSE(run(eWakePlacement::original));
+    EXPECT_TRUE(run(eWakePlacement::waker));
+    co_opt.load_balance_rate = balanceRate;
+}
+
+TEST(Scheduler, selectProcesser)
+{
+    Scheduler & sched = *Scheduler::Create();
+    std::thread([&]{ sched.Start(2, 2); }).detach();
+    while (sched.ProcesserCount() < 2)
+        usleep(1000);
+
+    // P0上堆积一批一直让出的协程
+    std::atomic<bool> stop{false};
+    for (int i = 0; i < 50; ++i)
+        go co_scheduler(sched) co_processer(0) [&]{
+            while (!stop)
+                co_yield;
+        };
+    usleep(10 * 1000);
+
+    // 非协程线程创建的协程, 随机比较两个P的负载, 大部分放到空闲的P1上
+    const int n = 40;
+    std::atomic<int> done{0}, onP1{0};
+    for (int i = 0; i < n; ++i)
+        go co_scheduler(sched) [&]{
+            if (Processer::GetCurrentProcesser()->Id() == 1)
+                ++onP1;
+            ++done;
+        };
+    while (done < n)
+        usleep(1000);
+    stop = true;
+    WaitUntilNoTaskS(sched);
+    EXPECT_GE(onP1, n / 2);
+}
+
+TEST(Scheduler, cpuTimeLoadBalance)
+{
+    // P0上4个重计算协程, P1上40个轻量协程. 按协程数P0更轻,
+    // 按cpu时间P0远重于P1, 负载均衡应该把重计算协程迁移到P1上
+    co_opt.load_balance_by_cpu_time = true;
+    Scheduler & sched = *Scheduler::Create();
+    std::thread([&]{ sched.Start(2, 2); }).detach();
+    while (sched.ProcesserCount() < 2)
+        usleep(1000);
+
+    std::atomic<bool> stop{false};
+    std::atomic<int> heavyOnP1{0};
+    go co_scheduler(sched) co_processer(1) [&]{
+        for (int i = 0; i < 40; ++i)
+            go co_scheduler(sched) [&]{
+                while (!stop)
+                    co_yield;
+            };
+    };
+
+    usleep(10 * 1000);
+
+    go co_scheduler(sched) co_processer(0) [&]{
+        for (int i = 0; i < 4; ++i)
+            go co_scheduler(sched) [&]{
+                while (!stop) {
+                    auto start = FastSteadyClock::now();
+                    while (FastSteadyClock::now() - start < std::chrono::milliseconds(2))
+                        ;
+                    if (Processer::GetCurrentProcesser()->Id() == 1)
+                        ++heavyOnP1;
+                    co_yield;
+                }
+            };
+    };
+
+    auto start = FastSteadyClock::now();
+    while (!heavyOnP1 && FastSteadyClock::now() - start < std::chrono::seconds(2))
+        usleep(1000);
+    stop = true;
+    WaitUntilNoTaskS(sched);
+    co_opt.load_balance_by_cpu_time = false;
+    EXPECT_GT(heavyOnP1, 0);
+}
+
+TEST(Scheduler, stats)
+{
+    co_opt.enable_coro_stat = true;
+    Scheduler & sched = *Scheduler::Create();
+    std::thread([&]{ sched.Start(2, 2); }).detach();
+    while (sched.ProcesserCount() < 2)
+        usleep(1000);
+
+    // 同一个P上的协程通过channel互相唤醒(本地唤醒), co_sleep由定时器线程唤醒(跨线程唤醒)
+    co_chan<int> ch;
+    go co_scheduler(sched) co_processer(0) [&]{
+        for (int i = 0; i < 100; ++i)
+            ch << i;
+    };
+    go co_scheduler(sched) co_processer(0) [&]{
+        int v;
+        for (int i = 0; i < 100; ++i)
+            ch >> v;
+    };
+    go co_scheduler(sched) co_processer(1) [&]{
+        for (int i = 0; i < 3; ++i) {
+            co_sleep(5);
+            co_yield;
+        }
+    };
+    WaitUntilNoTaskS(sched);
+    co_opt.enable_coro_stat = false;
+
+    SchedulerStats stats = sched.GetStats();
+    ProcesserStats & total = stats.total_;
+    EXPECT_EQ(stats.processers_.size(), 2u);
+    EXPECT_GT(total.switches_, 100u);
+    EXPECT_GT(total.wakeupLocal_, 0u);
+    EXPECT_GT(total.wakeupRemote_, 0u);
+    EXPECT_GT(total.parks_, 0u);
+    EXPECT_GE(total.runQueueLatency_.count_, 100u);
+    EXPECT_GE(total.sliceLength_.count_, total.runQueueLatency_.count_);
+    EXPECT_LE(total.sliceLength_.PercentileNs(0.5), total.sliceLength_.PercentileNs(0.99));
+    EXPECT_LE(total.sliceLength_.PercentileNs(1), total.sliceLength_.maxNs_);
+    cout << "switches=" << total.switches_ << " wakeup local/remote=" << total.wakeupLocal_
+        << "/" << total.wakeupRemote_ << " parks=" << total.parks_
+        << " runqueue p50/p99=" << total.runQueueLatency_.PercentileNs(0.5)
+        << "/" << total.runQueueLatency_.PercentileNs(0.99) << "ns"
+        << " slice avg=" << total.sliceLength_.AvgNs() << "ns" << endl;
+}
+
+TEST(Scheduler, trace)
+{
+    Scheduler & sched = *Scheduler::Create();
+    std::thread([&]{ sched.Start(2, 2); }).detach();
+    while (sched.ProcesserCount() < 2)
+        usleep(1000);
+
+    Tracer::Start(1024);
+    co_chan<int> ch;
+    go co_scheduler(sched) [&]{
+        for (int i = 0; i < 10; ++i)
+            ch << i;
+    };
+    go co_scheduler(sched) [&]{
+        int v;
+        for (int i = 0; i < 10; ++i)
+            ch >> v;
+        co_sleep(1);
+        co_yield;
+    };
+    WaitUntilNoTaskS(sched);
+
+    // 记录一个事件的开销(在另一个线程上测, 不覆盖本线程记录的事件)
+    std::thread([]{
+        const int n = 100000;
+        auto start = FastSteadyClock::now();
+        for (int i = 0; i < n; ++i)
+            TracePoint(eTraceEvent::steal, 0, i, 0);
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(FastSteadyClock::now() - start).count() / n;
+        cout << "trace record: " << ns << " ns" << endl;
+    }).join();
+    Tracer::Stop();
+
+    std::string json = Tracer::DumpChromeJson();
+    EXPECT_EQ(json.find("{\"displayTimeUnit\""), 0u);
+    EXPECT_EQ(json.substr(json.size() - 2), "]}");
+    EXPECT_NE(json.find("\"ph\":\"X\""), std::string::npos);
+    const char* names[] = {"\"create\"", "\"suspend\"", "\"wakeup\"", "\"timer\"", "\"steal\""};
+    for (const char* name : names) {
+        EXPECT_NE(json.find(name), std::string::npos) << name;
+    }
+
+    // 停止后不再记录
+    std::size_t size = json.size();
+    go co_scheduler(sched) []{};
+    WaitUntilNoTaskS(sched);
+    EXPECT_EQ(Tracer::DumpChromeJson().size(), size);
+}
@@ -75,3 +75,79 @@ TEST(Timer, OnTime3)
         q >> nullptr;
 }
 
+
+TEST(Timer, FastSteadyClockRecalibrate)
+{
+    FastSteadyClock::ThreadRun();
+
+    // 多个线程并发读, 中间穿插超过校准周期(20ms)的空闲, 触发按需校准. 每个线程看到的时间都不能倒退.
+    std::atomic<int> backward{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+        threads.emplace_back([&, t]{
+            auto last = FastSteadyClock::now();
+            for (int i = 0; i < 20; ++i) {
+                if (i % 4 == t)
+                    std::this_thread::sleep_for(milliseconds(25 + 10 * t));
+                for (int j = 0; j < 1000; ++j) {
+                    auto now = FastSteadyClock::now();
+                    if (now < last) ++backward;
+                    last = now;
+                }
+            }
+        });
+    for (auto & th : threads)
+        th.join();
+    EXPECT_EQ(backward, 0);
+
+    // 长时间空闲后的第一次读取也要准确, 不能用旧的校准点外推
+    auto fast0 = FastSteadyClock::now();
+    auto steady0 = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(milliseconds(300));
+    auto fast = FastSteadyClock::now() - fast0;
+    auto steady = std::chrono::steady_clock::now() - steady0;
+    auto diff = std::chrono::duration_cast<std::chrono::microseconds>(fast - steady).count();
+    EXPECT_LT(std::abs(diff), 1000);
+}
+
+TEST(Timer, FastSteadyClockConcurrentRecalibrate)
+{
+    FastSteadyClock::ThreadRun();
+
+    // 空闲超过校准周期后多个线程同时读取: 只有一个线程能抢到校准锁,
+    // 其他线程也必须得到新的时间, 不能停留在旧校准点之后的一个校准周期.
+    const int nThreads = 8;
+    std::atomic<int> backward{0}, inaccurate{0};
+    for (int round = 0; round < 5; ++round) {
+        std::this_thread::sleep_for(milliseconds(50));
+
+        std::atomic<int> ready{0};
+        std::atomic<bool> go_{false};
+        std::vector<std::thread> threads;
+        for (int t = 0; t < nThreads; ++t)
+            threads.emplace_back([&]{
+                ++ready;
+                while (!go_)
+                    ;
+                auto before = std::chrono::steady_clock::now();
+                auto now = FastSteadyClock::now();
+                auto after = std::chrono::steady_clock::now();
+                if (now < before - milliseconds(1) || now > after + milliseconds(1))
+                    ++inaccurate;
+
+                auto last = now;
+                for (int j = 0; j < 1000; ++j) {
+                    now = FastSteadyClock::now();
+                    if (now < last) ++backward;
+                    last = now;
+                }
+            });
+        while (ready < nThreads)
+            std::this_thread::yield();
+        go_ = true;
+        for (auto & th : threads)
+            th.join();
+    }
+    EXPECT_EQ(backward, 0);
+    EXPECT_EQ(inaccurate, 0);
+}